@@ -0,0 +1,30 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__ASSIGNMENT_HPP_
+#define CYBERDOG_VISION__ASSIGNMENT_HPP_
+
+#include <vector>
+
+namespace cyberdog_vision
+{
+
+// Minimum total cost assignment of rows to columns by the Hungarian method
+// in O(n^2 m). Every row of cost has the same length, assign gets the column
+// of each row, -1 for the rows left over when rows outnumber columns.
+float SolveAssignment(const std::vector<std::vector<float>> & cost, std::vector<int> & assign);
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__ASSIGNMENT_HPP_
@@ -17,8 +17,10 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 
 #include "tracker.hpp"
+#include "common_type.hpp"
 
 namespace cyberdog_vision
 {
@@ -31,18 +33,66 @@ public:
 
   bool SetTracker(const cv::Mat & img, const cv::Rect & bbox);
   bool Track(const cv::Mat & img, cv::Rect & bbox);
+  // Track with the body detections of the same image. A detection clearly
+  // overlapping the target is taken as it is and the siamese search is
+  // skipped, the search only runs when none or several detections fit.
+  bool Track(const cv::Mat & img, const std::vector<InferBbox> & bodies, cv::Rect & bbox);
   void SetLossTh(int loss_th);
   void ResetTracker();
   bool GetLostStatus();
 
 private:
+  // Detection fitting the box alone, -1 when none or several do
+  int MatchBody(const cv::Rect & box, const std::vector<InferBbox> & bodies, float & iou);
+  // Starts the siamese template in a search window placed around the box
+  bool InitTracker(const cv::Mat & img, const cv::Rect & bbox);
+  // Restarts the siamese state in a window placed around the last box from
+  // the crop the template was taken from, only the box moves with the target
+  bool MoveWindow(const cv::Mat & img);
+  // Region of the frame around the box the tracker sees and its downscale
+  void MakeWindow(const cv::Mat & img, const cv::Rect & box, cv::Rect & window, float & scale);
+  // The target nears the window border or its size no longer fits the window
+  bool NeedWindow(const cv::Mat & img);
+  // Part of the image inside the window, continuous as the sdk needs
+  const cv::Mat & WindowImage(const cv::Mat & img);
+  cv::Rect ToWindow(const cv::Rect & rect);
+  cv::Rect ToFrame(const cv::Rect & rect);
+  void UpdateBox(const cv::Mat & img, const cv::Rect & box);
+  // Blend the look of a box matched to a single detection into the target
+  void UpdateHist(const cv::Mat & img, const cv::Rect & box);
+  // Count a failed frame, a streak turns to searching and then to lost
+  void CountFail();
+  // Search the detections for the target at a low rate while it is away, a
+  // detection needs a close look and either a clear lead over the others or
+  // a place near where the target was lost
+  bool Reacquire(const cv::Mat & img, const std::vector<InferBbox> & bodies, cv::Rect & bbox);
+
   std::shared_ptr<TRACKER::Tracker> tracker_ptr_;
+  // Target of the last frame and that frame, shared not copied
+  cv::Rect last_box_;
+  cv::Mat last_img_;
+  // Hue and saturation histogram of the target, refreshed while a single
+  // detection confirms it
+  cv::Mat target_hist_;
+  // Crop around the box the template was last started from and the box in it
+  cv::Mat template_img_;
+  cv::Rect template_box_;
+  // Search window in frame coordinates, the siamese state lives in it
+  cv::Rect window_;
+  float window_scale_;
+  cv::Mat window_img_;
+  // Smoothed motion of the box center in pixels per frame
+  cv::Point2f velocity_;
 
   int gpu_id_;
   int loss_th_;
   int fail_count_;
+  int search_count_;
   bool is_init_;
   bool is_lost_;
+  // The siamese state lags behind boxes taken from detections
+  bool is_stale_;
+  bool is_searching_;
 };
 
 }  // namespace cyberdog_vision
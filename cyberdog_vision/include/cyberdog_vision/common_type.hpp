@@ -15,8 +15,11 @@
 #ifndef CYBERDOG_VISION__COMMON_TYPE_HPP_
 #define CYBERDOG_VISION__COMMON_TYPE_HPP_
 
+#include <stdint.h>
+
 #include <string>
 #include <mutex>
+#include <atomic>
 #include <vector>
 #include <condition_variable>
 
@@ -56,43 +59,58 @@ struct GestureInfo
 
 struct StampedImage
 {
+  uint64_t frame_id;
   std_msgs::msg::Header header;
   cv::Mat img;
+  StampedImage()
+  {
+    frame_id = 0;
+  }
 };
 
+// Latest camera frame fanned out to every reader. Each reader keeps its own
+// cursor of the last seq it took, so no reader consumes another's frame.
 struct GlobalImageBuf
 {
-  bool is_filled;
+  uint64_t seq;
   std::mutex mtx;
   std::condition_variable cond;
   std::vector<StampedImage> img_buf;
   GlobalImageBuf()
   {
-    is_filled = false;
+    seq = 0;
   }
 };
 
-struct BodyResults
+struct AlgoStruct
 {
-  bool is_filled;
+  bool is_called;
   std::mutex mtx;
   std::condition_variable cond;
-  StampedImage detection_img;
-  std::vector<BodyFrameInfo> body_infos;
-  BodyResults()
+  AlgoStruct()
   {
-    is_filled = false;
+    is_called = false;
   }
 };
 
-struct AlgoStruct
+struct EnrollStruct
 {
-  bool is_called;
+  bool has_request;
+  // The worker is inside an enrollment, cancel waits for it to leave
+  bool is_running;
+  std::atomic<bool> is_cancel;
+  std::atomic<bool> is_exit;
+  std::string name;
+  bool is_host;
   std::mutex mtx;
   std::condition_variable cond;
-  AlgoStruct()
+  EnrollStruct()
   {
-    is_called = false;
+    has_request = false;
+    is_running = false;
+    is_cancel = false;
+    is_exit = false;
+    is_host = false;
   }
 };
 
@@ -116,7 +134,20 @@ inline void ImgConvert(const cv::Mat & img, XMImage & xm_img)
   xm_img.type = ColorType::BGR;
 }
 
-inline std::vector<InferBbox> BodyConvert(BodyFrameInfo & infos)
+// Part of the rect inside the image, empty when it lies fully outside
+inline cv::Rect ClampRect(const cv::Rect & rect, const cv::Mat & img)
+{
+  return rect & cv::Rect(0, 0, img.cols, img.rows);
+}
+
+inline float RectIoU(const cv::Rect & a, const cv::Rect & b)
+{
+  int inter = (a & b).area();
+  int uni = a.area() + b.area() - inter;
+  return uni > 0 ? static_cast<float>(inter) / uni : 0.f;
+}
+
+inline std::vector<InferBbox> BodyConvert(const BodyFrameInfo & infos)
 {
   std::vector<InferBbox> infer_bboxes;
   for (auto & info : infos) {
@@ -0,0 +1,90 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__DETECTION_HISTORY_HPP_
+#define CYBERDOG_VISION__DETECTION_HISTORY_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "builtin_interfaces/msg/time.hpp"
+
+#include "common_type.hpp"
+
+namespace cyberdog_vision
+{
+
+inline uint64_t StampToNs(const builtin_interfaces::msg::Time & stamp)
+{
+  return static_cast<uint64_t>(stamp.sec) * 1000000000ULL + stamp.nanosec;
+}
+
+// Body detections of one frame together with the frame they were computed on.
+// The image shares its buffer with the producer, every frame from ImageProc
+// owns a fresh allocation so holding it here never needs a copy.
+struct DetectionFrame
+{
+  uint64_t stamp_ns;
+  StampedImage frame;
+  BodyFrameInfo infos;
+  DetectionFrame()
+  {
+    stamp_ns = 0;
+  }
+};
+
+// Fixed-capacity ring of the latest detection frames, indexed by stamp.
+class DetectionHistory
+{
+public:
+  DetectionHistory();
+
+  void SetCapacity(size_t capacity);
+  void Push(const StampedImage & img, const BodyFrameInfo & infos);
+  void Clear();
+
+  bool Empty() const;
+  size_t Size() const;
+
+  // Index 0 is the newest frame, Size() - 1 the oldest.
+  const DetectionFrame & At(size_t index) const;
+  const DetectionFrame & Latest() const;
+  const DetectionFrame * FindByStamp(const builtin_interfaces::msg::Time & stamp) const;
+
+private:
+  std::vector<DetectionFrame> slots_;
+  std::unordered_map<uint64_t, size_t> stamp_index_;
+  size_t head_;
+  size_t count_;
+};
+
+struct BodyResults
+{
+  bool is_filled;
+  std::mutex mtx;
+  std::condition_variable cond;
+  DetectionHistory history;
+  BodyResults()
+  {
+    is_filled = false;
+  }
+};
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__DETECTION_HISTORY_HPP_
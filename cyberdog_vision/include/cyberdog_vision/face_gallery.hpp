@@ -0,0 +1,143 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__FACE_GALLERY_HPP_
+#define CYBERDOG_VISION__FACE_GALLERY_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "cyberdog_vision/feature_ops.hpp"
+#include "cyberdog_vision/feature_quant.hpp"
+#include "cyberdog_vision/face_index.hpp"
+
+namespace cyberdog_vision
+{
+
+struct GalleryMatch
+{
+  size_t index;
+  float score;
+  GalleryMatch()
+  {
+    index = 0;
+    score = 0.f;
+  }
+};
+
+const size_t kMaxFaceTemplates = 5;
+// Galleries from this size on are searched through an ivf index
+const size_t kFaceIndexMinSize = 1024;
+
+// Enrolled face features kept as aligned row-major matrices, all rows are
+// L2 normalized so a match score is the cosine similarity. Every identity
+// holds up to kMaxFaceTemplates templates and their quality weighted mean,
+// the mean rows are scanned first and only the best candidates are refined
+// against their templates. Large galleries narrow the mean row scan with a
+// FaceIndex, changes are inserted into the trained lists but retraining is
+// up to the owner through NeedIndex and BuildIndex, so it can run on a copy
+// away from the writers. Rows and templates may be held as fp16 or int8,
+// the query stays float and is scored against the stored codes directly.
+class FaceGallery
+{
+public:
+  FaceGallery();
+
+  int Add(const std::string & name, const std::vector<float> & feat, bool is_host);
+  int Add(
+    const std::string & name, const std::vector<std::vector<float>> & templates,
+    const std::vector<float> & weights, bool is_host);
+  // Bulk load of normalized rows already laid out with AlignedStride(dim),
+  // templates and weights hold kMaxFaceTemplates slots per identity.
+  int Assign(
+    size_t dim, const float * rows, const float * templates, const float * weights,
+    const std::vector<uint8_t> & template_nums, const std::vector<std::string> & names,
+    const std::vector<uint8_t> & hosts);
+  int Remove(const std::string & name);
+  int Rename(const std::string & ori_name, const std::string & new_name);
+  void Clear();
+  // Requantize every row, later changes keep the precision
+  void SetPrecision(FeatPrecision precision);
+
+  bool Find(const std::string & name) const;
+  bool GetIndex(const std::string & name, size_t & index) const;
+  bool Empty() const;
+  size_t Size() const;
+  size_t Dim() const;
+  size_t Stride() const;
+  FeatPrecision Precision() const;
+  // Memory held by rows, templates and weights
+  size_t Bytes() const;
+  const float * WeightData() const;
+  const std::string & Name(size_t index) const;
+  bool IsHost(size_t index) const;
+  // Copy out Stride() floats, dequantized when stored quantized
+  void GetFeature(size_t index, float * feat) const;
+  size_t TemplateNum(size_t index) const;
+  void GetTemplate(size_t index, size_t slot, float * feat) const;
+  float Weight(size_t index, size_t slot) const;
+
+  // Best k identities sorted by descending template score
+  void Query(const std::vector<float> & feat, size_t k, std::vector<GalleryMatch> & matches) const;
+  // Exhaustive search, reference for the indexed query
+  void QueryExact(
+    const std::vector<float> & feat, size_t k,
+    std::vector<GalleryMatch> & matches) const;
+
+  // Retrain the index, dropped below kFaceIndexMinSize rows
+  void BuildIndex();
+  // Large enough for an index and none trained, or doubled since training
+  bool NeedIndex() const;
+  // Take over a stored index trained on exactly these rows
+  int SetIndex(const FaceIndex & index);
+  const FaceIndex & Index() const;
+
+private:
+  bool Normalize(const std::vector<float> & feat, AlignedFloats & query) const;
+  void TopK(
+    const float * query, float query_sum, const std::vector<uint32_t> * rows, size_t k,
+    std::vector<GalleryMatch> & matches) const;
+  void RefineTopK(
+    const float * query, float query_sum, size_t k,
+    std::vector<GalleryMatch> & matches) const;
+  void UpdateIndex(size_t row);
+  float Refine(const float * query, float query_sum, size_t index) const;
+  void MoveRow(size_t from, size_t to);
+
+  size_t dim_;
+  size_t stride_;
+  FeatPrecision precision_;
+  FeatureRows feats_;
+  // kMaxFaceTemplates rows per identity
+  FeatureRows templates_;
+  std::vector<float> weights_;
+  std::vector<uint8_t> template_nums_;
+  std::vector<std::string> names_;
+  std::vector<uint8_t> hosts_;
+  std::unordered_map<std::string, size_t> index_;
+  FaceIndex ivf_;
+};
+
+// Probe the quantized gallery with templates of the reference and compare
+// the best scores, both have to hold the same identities in the same rows.
+void MeasureQuantError(
+  const FaceGallery & reference, const FaceGallery & quantized,
+  size_t max_probes, QuantReport & report);
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__FACE_GALLERY_HPP_
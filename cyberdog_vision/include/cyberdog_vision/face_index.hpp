@@ -0,0 +1,72 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__FACE_INDEX_HPP_
+#define CYBERDOG_VISION__FACE_INDEX_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "cyberdog_vision/feature_ops.hpp"
+
+namespace cyberdog_vision
+{
+
+// Inverted file index over normalized gallery rows. Rows are clustered by
+// spherical k-means, a query only scans the rows of its nprobe nearest
+// clusters. Row numbers follow the gallery, including its swap with the
+// last row on removal.
+class FaceIndex
+{
+public:
+  FaceIndex();
+
+  void Clear();
+  bool Empty() const;
+
+  void Train(const float * rows, size_t count, size_t dim, size_t nlist);
+  // Restore a trained index, row_lists holds the cluster of every row
+  int Assign(
+    size_t dim, size_t nlist, const float * centroids,
+    const std::vector<uint32_t> & row_lists);
+  // Append a row or move an existing one to the cluster of its new feature
+  void Insert(size_t row, const float * feat);
+  void Remove(size_t row);
+  void Search(const float * query, size_t nprobe, std::vector<uint32_t> & rows) const;
+
+  size_t Nlist() const;
+  size_t Size() const;
+  size_t TrainedSize() const;
+  const float * Centroids() const;
+  const std::vector<uint32_t> & RowLists() const;
+
+private:
+  size_t Nearest(const float * feat) const;
+  void Unlink(size_t row);
+  void Link(size_t row, size_t list);
+
+  size_t dim_;
+  size_t stride_;
+  size_t nlist_;
+  size_t trained_size_;
+  AlignedFloats centroids_;
+  std::vector<std::vector<uint32_t>> lists_;
+  std::vector<uint32_t> row_list_;
+  std::vector<uint32_t> row_pos_;
+};
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__FACE_INDEX_HPP_
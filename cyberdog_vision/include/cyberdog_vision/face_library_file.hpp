@@ -0,0 +1,153 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__FACE_LIBRARY_FILE_HPP_
+#define CYBERDOG_VISION__FACE_LIBRARY_FILE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "cyberdog_vision/face_gallery.hpp"
+
+namespace cyberdog_vision
+{
+
+const char kFaceLibraryDir[] = "/home/mi/.faces/";
+const char kFaceLibraryYaml[] = "/home/mi/.faces/faceinfo.yaml";
+const char kFaceLibraryBin[] = "/home/mi/.faces/faceinfo.bin";
+const char kFaceJournal[] = "/home/mi/.faces/faceinfo.journal";
+const char kFaceJournalOld[] = "/home/mi/.faces/faceinfo.journal.old";
+const char kFaceIndexBin[] = "/home/mi/.faces/faceinfo.ivf";
+
+const uint32_t kFaceLibraryVersion = 2;
+
+// Binary library layout:
+//   FaceLibraryHeader
+//   count * stride floats, normalized aggregate features in FaceGallery row layout
+//   count * kMaxFaceTemplates * stride floats, normalized templates
+//   count * kMaxFaceTemplates floats, template weights
+//   count * {uint32 name length, uint8 is_host, uint8 template num, name bytes}
+// Version 1 files hold the aggregate rows only and names without template
+// num, they load as single template identities. The checksum is the crc32
+// of everything following the header, journal_seq is the last journal
+// record already contained in the snapshot. Only float galleries are
+// written, a quantized session reads them back to compact.
+struct FaceLibraryHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t dim;
+  uint32_t stride;
+  uint32_t count;
+  uint32_t names_size;
+  uint32_t checksum;
+  uint32_t journal_seq;
+};
+
+const uint32_t kFaceIndexVersion = 1;
+
+// Index file layout:
+//   FaceIndexHeader
+//   nlist * stride floats, normalized centroids
+//   count * uint32 cluster of every gallery row
+// rows_checksum is the crc32 of the aggregate rows the index was built on,
+// a mismatch with the loaded library means the index is stale.
+struct FaceIndexHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t dim;
+  uint32_t nlist;
+  uint32_t count;
+  uint32_t rows_checksum;
+  uint32_t checksum;
+  uint32_t reserved;
+};
+
+enum FaceJournalOp
+{
+  kJournalAdd = 1,
+  kJournalRename,
+  kJournalDelete
+};
+
+// Journal record layout:
+//   FaceJournalHeader, name bytes, new name bytes, feat_len floats
+// The floats are template_num templates followed by their weights, records
+// with template_num 0 carry one unweighted feature.
+// The checksum is the crc32 of the header with checksum zeroed and the body.
+struct FaceJournalHeader
+{
+  uint32_t magic;
+  uint32_t seq;
+  uint8_t op;
+  uint8_t is_host;
+  uint16_t template_num;
+  uint32_t name_size;
+  uint32_t new_name_size;
+  uint32_t feat_len;
+  uint32_t checksum;
+};
+
+struct FaceJournalRecord
+{
+  uint32_t seq;
+  uint8_t op;
+  bool is_host;
+  std::string name;
+  std::string new_name;
+  std::vector<std::vector<float>> templates;
+  std::vector<float> weights;
+  FaceJournalRecord()
+  {
+    seq = 0;
+    op = 0;
+    is_host = false;
+  }
+};
+
+uint32_t Crc32(const void * data, size_t len, uint32_t crc = 0);
+// Write to a temp file and rename so a crash never leaves a partial file
+// Sync the directory holding path so a rename, create or unlink in it
+// survives a power cut
+int SyncParentDir(const std::string & path);
+int WriteFileAtomic(const std::string & path, const std::vector<uint8_t> & buf);
+
+int ReadFaceLibraryYaml(const std::string & path, FaceGallery & gallery);
+int ReadFaceLibraryBin(const std::string & path, FaceGallery & gallery, uint32_t & journal_seq);
+// Only float galleries are written, a quantized one is refused
+int WriteFaceLibraryBin(
+  const std::string & path, const FaceGallery & gallery,
+  uint32_t journal_seq);
+
+// The index is optional, a missing or stale file just means a rebuild.
+int ReadFaceIndexBin(const std::string & path, FaceGallery & gallery);
+int WriteFaceIndexBin(const std::string & path, const FaceGallery & gallery);
+
+void EncodeJournalRecord(const FaceJournalRecord & record, std::vector<uint8_t> & buf);
+void ApplyJournalRecord(const FaceJournalRecord & record, FaceGallery & gallery);
+// Apply records newer than journal_seq up to max_seq and advance it,
+// valid_size is the length of the intact prefix so a torn tail can be cut off.
+int ReplayFaceJournal(
+  const std::string & path, FaceGallery & gallery, uint32_t & journal_seq,
+  size_t & valid_size, uint32_t max_seq = UINT32_MAX);
+
+// Load the default snapshot, migrating the legacy yaml file on first use.
+int LoadFaceLibrarySnapshot(FaceGallery & gallery, uint32_t & journal_seq);
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__FACE_LIBRARY_FILE_HPP_
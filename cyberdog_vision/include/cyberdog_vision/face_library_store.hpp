@@ -0,0 +1,82 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__FACE_LIBRARY_STORE_HPP_
+#define CYBERDOG_VISION__FACE_LIBRARY_STORE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <condition_variable>
+
+#include "cyberdog_vision/face_library_file.hpp"
+
+namespace cyberdog_vision
+{
+
+// Persists face library changes as an append-only journal on top of the
+// binary snapshot. Every change is synced before returning, snapshots are
+// rewritten by a background thread once the journal grows. The float
+// library only lives on disk, the thread reads it back from the snapshot
+// and the journal, so the caller may keep a quantized copy in memory.
+class FaceLibraryStore
+{
+public:
+  FaceLibraryStore();
+  ~FaceLibraryStore();
+
+  int Open(FaceGallery & gallery);
+  // Float library as of the last change, waits for a running compaction
+  int Load(FaceGallery & gallery);
+  int Add(
+    const std::string & name, const std::vector<std::vector<float>> & templates,
+    const std::vector<float> & weights, bool is_host);
+  int Rename(const std::string & ori_name, const std::string & new_name);
+  int Delete(const std::string & name);
+
+  bool NeedCompaction();
+  void Compact();
+
+private:
+  int Load(
+    FaceGallery & gallery, uint32_t max_seq, uint32_t & journal_seq,
+    size_t & valid_size);
+  int Append(FaceJournalRecord & record);
+  void CompactProc();
+
+  std::shared_ptr<std::thread> compact_thread_;
+  std::mutex mtx_;
+  std::condition_variable cond_;
+
+  // Last record the pending snapshot covers
+  uint32_t pending_seq_;
+  uint32_t seq_;
+  size_t journal_size_;
+  // Journal size at the last compaction attempt, a failed snapshot waits
+  // for another compact_size_th_ bytes before it is retried
+  size_t compact_base_;
+  size_t compact_size_th_;
+  int journal_fd_;
+  bool has_pending_;
+  bool is_compacting_;
+  bool is_exit_;
+};
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__FACE_LIBRARY_STORE_HPP_
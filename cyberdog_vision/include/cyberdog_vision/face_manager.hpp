@@ -18,7 +18,13 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include "cyberdog_vision/face_recognition.hpp"
+#include "cyberdog_vision/face_library_store.hpp"
+#include "cyberdog_vision/ring_stats.hpp"
 
 namespace cyberdog_vision
 {
@@ -29,66 +35,59 @@ struct FaceId
   bool is_host;
 };
 
-template<typename T, size_t COUNT>
-struct SizedVector
+/* enrollment template captured at one head pose */
+struct FaceTemplate
 {
-public:
-  SizedVector()
-  {
-    m_index = 0;
-  }
-
-  void push_back(const T & obj)
-  {
-    if (m_vector.size() >= COUNT) {
-      m_index %= COUNT;
-      m_vector[m_index] = obj;
-      m_index++;
-    } else {
-      m_vector.push_back(obj);
-    }
-  }
-
-  size_t size()
-  {
-    return m_vector.size();
-  }
-
-  std::vector<T> & vector()
-  {
-    return m_vector;
-  }
+  std::vector<float> feat;
+  float yaw;
+  float pitch;
+  float quality;
+};
 
-  void clear()
-  {
-    m_vector.clear();
-    m_index = 0;
-  }
+/* max frames of the enrollment stability window */
+const size_t kFaceStatsCapacity = 30;
 
-  bool full()
+struct FaceEnrollParams
+{
+  /* frames the pose has to stay stable */
+  size_t window;
+  /* max stdev of yaw, pitch and roll in degree */
+  float pose_stable_thres;
+  float yaw_legal_thres;
+  float pitch_legal_thres;
+  float row_legal_thres;
+  /* stdev and min mean of face area over frame area */
+  float area_stable_thres;
+  float area_legal_thres;
+  FaceEnrollParams()
   {
-    return m_vector.size() == COUNT;
+    window = 6;
+    pose_stable_thres = 3.0f;
+    yaw_legal_thres = 30.0f;
+    pitch_legal_thres = 20.0f;
+    row_legal_thres = 30.0f;
+    area_stable_thres = 0.0010f;
+    area_legal_thres = 0.005f;
   }
-
-private:
-  std::vector<T> m_vector;
-  size_t m_index;
 };
 
-
 class FaceManager
 {
 public:
   static FaceManager * getInstance();
   static const std::string getFaceDataPath();
-  std::map<std::string, std::vector<float>> & getFeatures();
+  std::shared_ptr<const FaceGallery> getSnapshot();
   int addFaceIDCacheInfo(std::string & name, bool is_host);
   int addFaceFeatureCacheInfo(std::vector<EntryFaceInfo> & faceinfo);
+  int offerFaceTemplate(std::vector<EntryFaceInfo> & faceinfo);
   int cancelAddFace();
   int checkFacePose(std::vector<EntryFaceInfo> & faceinfo, std::string & msg);
+  /* call before an enrollment starts */
+  void setEnrollParams(const FaceEnrollParams & params);
+  /* requantize the library and log the score drift against the float one */
+  void setFeatPrecision(FeatPrecision precision);
   int confirmFace(std::string & name, bool is_host);
   int updateFaceId(std::string & ori_name, std::string & new_name);
-  bool updateFeaturesFile();
   int deleteFace(std::string & face_name);
   std::string getAllFaces();
   bool findFace(const std::string & face_name);
@@ -99,6 +98,13 @@ private:
   ~FaceManager();
   void initialize();
   bool loadFeatures();
+  void compactFeaturesFile();
+  void publishSnapshot(const std::shared_ptr<const FaceGallery> & gallery);
+  /* writers change a copy of the current library and publish it */
+  std::shared_ptr<FaceGallery> copySnapshot();
+  /* call with m_mutex held after every add or remove */
+  void scheduleIndex(const FaceGallery & gallery);
+  void indexProc();
 
   enum FaceStatsType
   {
@@ -110,17 +116,31 @@ private:
     statsFaceTypeMax,
   };
 
-  std::map<std::string, std::vector<float>> m_features;
-  std::map<std::string, bool> m_hostMap;
+  /* immutable library version read by recognition, replaced on every change,
+   * held in m_precision only. The float library stays on disk and is read
+   * back for precision switches and compaction */
+  std::shared_ptr<const FaceGallery> m_gallery;
+  /* serialize library writers */
   std::mutex m_mutex;
+  FeatPrecision m_precision;
+  FaceLibraryStore m_store;
+  /* retrains the face index on a copy of the library outside m_mutex, the
+   * result is dropped when the library changed meanwhile */
+  std::shared_ptr<std::thread> m_indexThread;
+  std::condition_variable m_indexCond;
+  uint64_t m_version;
+  bool m_indexPending;
+  bool m_indexExit;
 
   bool m_inFaceAdding;
-  /* save last face info, wait for user confirm */
+  /* save last face info, wait for user confirm, guarded by m_cacheMutex */
   FaceId m_faceIdCached;
-  std::vector<float> m_faceFeatsCached;
+  /* pose diverse templates of the face being added */
+  std::mutex m_cacheMutex;
+  std::vector<FaceTemplate> m_faceTemplatesCached;
 
-  /**/
-  SizedVector<float, 6> m_faceStats[statsFaceTypeMax];
+  FaceEnrollParams m_enrollParams;
+  RingStats<float, kFaceStatsCapacity> m_faceStats[statsFaceTypeMax];
 };
 
 }  // namespace cyberdog_vision
@@ -17,15 +17,73 @@
 
 #include <string>
 #include <vector>
-#include <memory>
 #include <map>
+#include <memory>
+#include <mutex>
 
 #include "XMFaceAPI.h"
 #include "common_type.hpp"
+#include "face_gallery.hpp"
 
 namespace cyberdog_vision
 {
 
+// Cosine a face needs against the library, the threshold the sdk was
+// calibrated with. test_face_sdk checks MatchFace scores against the sdk.
+const float kFaceMatchThres = 0.65f;
+
+// Faces below these limits are too poor to match and skip the gallery
+struct FaceQualityParams
+{
+  // Face area over frame area
+  float min_face_ratio;
+  // Variance of the laplacian over the gray face crop
+  float min_sharpness;
+  // Pose limits in degree
+  float max_yaw;
+  float max_pitch;
+  float max_roll;
+  FaceQualityParams()
+  {
+    min_face_ratio = 0.002f;
+    min_sharpness = 20.f;
+    max_yaw = 50.f;
+    max_pitch = 40.f;
+    max_roll = 45.f;
+  }
+};
+
+struct FaceQualityStats
+{
+  uint64_t checked;
+  uint64_t skipped_small;
+  uint64_t skipped_blur;
+  uint64_t skipped_pose;
+  // Attribute crops left out for poor faces
+  uint64_t skipped_attr;
+  // Detection, landmarks and features come from one sdk call and are spent
+  // before the gate, only the match and the attribute crops are saved.
+  // Both estimated from the mean cost of the ones actually run.
+  double match_saved_ms;
+  double attr_saved_ms;
+  FaceQualityStats()
+  {
+    checked = 0;
+    skipped_small = 0;
+    skipped_blur = 0;
+    skipped_pose = 0;
+    skipped_attr = 0;
+    match_saved_ms = 0.0;
+    attr_saved_ms = 0.0;
+  }
+};
+
+// Recognition runs on an sdk instance without attribute models. Emotion
+// and age get a second instance holding the detection, landmark and
+// attribute models only, run on crops around faces already detected, so the
+// caller decides how often attributes are computed. Where the sdk refuses
+// an instance without the feature model the attributes come with every
+// recognition pass instead.
 class FaceRecognition
 {
 public:
@@ -34,13 +92,51 @@ public:
   ~FaceRecognition();
 
   int GetFaceInfo(const cv::Mat & img, std::vector<EntryFaceInfo> & faces_info);
+  // Emotion and age of the usable entries, the rects are in frame
+  // coordinates and a face missed by the pass is left out
+  int GetFaceAttributes(
+    const cv::Mat & img, const std::vector<EntryFaceInfo> & entries,
+    const std::vector<bool> & usable, std::vector<EntryFaceInfo> & faces_info);
+  bool HasAttributes() const;
   int GetRecognitionResult(
-    const cv::Mat & img, const std::map<std::string, std::vector<float>> & endlib_feats,
+    const cv::Mat & img, const FaceGallery & gallery,
     std::vector<MatchFaceInfo> & faces_info);
+  // Fill identity of one detected face from the gallery
+  void MatchFace(
+    const EntryFaceInfo & entry, const FaceGallery & gallery,
+    MatchFaceInfo & face_info);
+  void SetMatchThres(float thres);
+  float GetMatchThres() const;
+  // Match inside the sdk at kFaceMatchThres, the reference MatchFace is
+  // checked against, too slow for the service path
+  int GetSdkMatchResult(
+    const cv::Mat & img, const std::map<std::string, std::vector<float>> & library,
+    std::vector<MatchFaceInfo> & faces_info);
+
+  void SetQualityParams(const FaceQualityParams & params);
+  // Cheap checks ahead of matching, pose first, then size and sharpness
+  bool CheckQuality(const cv::Mat & img, const EntryFaceInfo & entry);
+  FaceQualityStats GetQualityStats();
 
 private:
+  // Null when the sdk refuses the models
+  XMFaceAPI * CreateSdk(
+    const std::string & model_path, bool open_emotion, bool open_age, bool attr_only);
   void FillParam(const std::string & model_path, FaceParam & param);
+  float Sharpness(const cv::Mat & img, const cv::Rect & rect);
   XMFaceAPI * face_ptr_;
+  XMFaceAPI * attr_ptr_;
+  // Attributes come with recognition, no separate instance
+  bool attr_inline_;
+  float feat_thres_;
+
+  std::mutex quality_mtx_;
+  FaceQualityParams quality_params_;
+  FaceQualityStats quality_stats_;
+  uint64_t match_count_;
+  double match_ms_;
+  uint64_t attr_count_;
+  double attr_ms_;
 };
 
 }  // namespace cyberdog_vision
@@ -0,0 +1,122 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__FACE_TRACK_CACHE_HPP_
+#define CYBERDOG_VISION__FACE_TRACK_CACHE_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "common_type.hpp"
+
+namespace cyberdog_vision
+{
+
+struct FaceTrackParams
+{
+  // Min iou to continue a face track
+  float iou_thres;
+  // Identities scored above this are reused without matching
+  float confident_score;
+  // Longest reuse of a cached identity before matching again
+  uint64_t rematch_ns;
+  // Longest run of frames served from body tracks without the face sdk
+  uint64_t redetect_ns;
+  // Sdk passes a track may miss before it is dropped
+  int max_miss;
+  // Emotion and age of a track are recomputed after this period
+  uint64_t attr_refresh_ns;
+  FaceTrackParams()
+  {
+    iou_thres = 0.3f;
+    confident_score = 0.75f;
+    rematch_ns = 1000000000ULL;
+    redetect_ns = 500000000ULL;
+    max_miss = 2;
+    attr_refresh_ns = 2000000000ULL;
+  }
+};
+
+struct FaceTrack
+{
+  MatchFaceInfo info;
+  // Body holding the face at the last update, empty when not linked
+  cv::Rect body;
+  uint64_t match_ns;
+  // Last attribute pass over the track, 0 before the first
+  uint64_t attr_ns;
+  int miss;
+  FaceTrack()
+  {
+    match_ns = 0;
+    attr_ns = 0;
+    miss = 0;
+  }
+};
+
+// Keeps identities of faces across frames so the face sdk and the gallery
+// match only run for new or uncertain faces. Faces linked to a body box
+// follow that body between sdk passes, faces matched with high confidence
+// reuse their identity until the rematch period expires. Emotion and age
+// are computed once per track and refreshed at attr_refresh_ns.
+class FaceTrackCache
+{
+public:
+  FaceTrackCache();
+
+  void SetParams(const FaceTrackParams & params);
+  void Clear();
+
+  // Whether the frame has to go through the face sdk
+  bool NeedDetect(uint64_t stamp_ns, const BodyFrameInfo & bodies) const;
+  // Associate faces of an sdk pass with the tracks. Faces of known tracks
+  // carry the track identity and attributes, need_match is false while the
+  // identity is fresh and confident.
+  void Associate(
+    uint64_t stamp_ns, const std::vector<EntryFaceInfo> & entries,
+    const BodyFrameInfo & bodies, std::vector<MatchFaceInfo> & faces,
+    std::vector<bool> & need_match);
+  // Whether a usable face of the last Associate lacks fresh attributes
+  bool NeedAttributes(uint64_t stamp_ns, const std::vector<bool> & usable) const;
+  // Copy emotion and age of an attribute pass onto the usable faces of the
+  // last Associate, faces it missed keep their previous attributes
+  void ApplyAttributes(
+    uint64_t stamp_ns, const std::vector<EntryFaceInfo> & attrs,
+    const std::vector<bool> & usable, std::vector<MatchFaceInfo> & faces);
+  // Store identities of the faces from the last Associate, matched marks
+  // the faces whose identity was refreshed from the gallery
+  void Commit(
+    uint64_t stamp_ns, const std::vector<MatchFaceInfo> & faces,
+    const std::vector<bool> & matched);
+  // Cached faces moved along with their bodies for frames skipping the sdk
+  void Predict(const BodyFrameInfo & bodies, std::vector<MatchFaceInfo> & faces);
+
+private:
+  int LinkBody(const cv::Rect & face, const BodyFrameInfo & bodies) const;
+  int FindBody(const cv::Rect & body, const BodyFrameInfo & bodies) const;
+
+  FaceTrackParams params_;
+  std::vector<FaceTrack> tracks_;
+  // Track index of every face from the last Associate, -1 for new tracks
+  std::vector<int> pending_;
+  std::vector<cv::Rect> pending_bodies_;
+  std::vector<uint64_t> pending_attr_ns_;
+  std::vector<cv::Rect> detect_bodies_;
+  uint64_t detect_ns_;
+};
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__FACE_TRACK_CACHE_HPP_
@@ -0,0 +1,145 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__FEATURE_OPS_HPP_
+#define CYBERDOG_VISION__FEATURE_OPS_HPP_
+
+#include <stdlib.h>
+#include <math.h>
+
+#include <new>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace cyberdog_vision
+{
+
+// Feature rows are padded to a multiple of kFeatAlign floats so the kernels
+// below never need a scalar tail on gallery data.
+const size_t kFeatAlign = 8;
+const size_t kFeatAlignBytes = 32;
+
+inline size_t AlignedStride(size_t dim)
+{
+  return (dim + kFeatAlign - 1) / kFeatAlign * kFeatAlign;
+}
+
+template<typename T>
+struct AlignedAllocator
+{
+  using value_type = T;
+
+  AlignedAllocator() = default;
+  template<typename U>
+  AlignedAllocator(const AlignedAllocator<U> &) {}
+
+  T * allocate(size_t n)
+  {
+    void * ptr = nullptr;
+    if (0 != posix_memalign(&ptr, kFeatAlignBytes, n * sizeof(T))) {
+      throw std::bad_alloc();
+    }
+    return reinterpret_cast<T *>(ptr);
+  }
+
+  void deallocate(T * ptr, size_t)
+  {
+    free(ptr);
+  }
+
+  template<typename U>
+  struct rebind
+  {
+    using other = AlignedAllocator<U>;
+  };
+};
+
+template<typename T, typename U>
+inline bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &)
+{
+  return true;
+}
+
+template<typename T, typename U>
+inline bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &)
+{
+  return false;
+}
+
+using AlignedFloats = std::vector<float, AlignedAllocator<float>>;
+
+inline float Dot(const float * a, const float * b, size_t len)
+{
+  size_t i = 0;
+  float sum = 0.f;
+#if defined(__AVX2__)
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (; i + 16 <= len; i += 16) {
+#if defined(__FMA__)
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+#else
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    acc1 = _mm256_add_ps(
+      acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+#endif
+  }
+  for (; i + 8 <= len; i += 8) {
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 0x55));
+  sum = _mm_cvtss_f32(half);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  float32x4_t acc0 = vdupq_n_f32(0.f);
+  float32x4_t acc1 = vdupq_n_f32(0.f);
+  for (; i + 8 <= len; i += 8) {
+    acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  acc0 = vaddq_f32(acc0, acc1);
+  float32x2_t pair = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+  sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+  for (; i < len; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+// Normalize in place, returns false for an all-zero vector.
+inline bool L2Normalize(float * feat, size_t len)
+{
+  float norm = sqrtf(Dot(feat, feat, len));
+  if (norm <= 0.f) {
+    return false;
+  }
+  float inv = 1.f / norm;
+  for (size_t i = 0; i < len; ++i) {
+    feat[i] *= inv;
+  }
+  return true;
+}
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__FEATURE_OPS_HPP_
@@ -0,0 +1,272 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__FEATURE_QUANT_HPP_
+#define CYBERDOG_VISION__FEATURE_QUANT_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "cyberdog_vision/feature_ops.hpp"
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace cyberdog_vision
+{
+
+enum FeatPrecision
+{
+  kFeatFp32 = 0,
+  kFeatFp16,
+  kFeatInt8
+};
+
+const char * FeatPrecisionName(FeatPrecision precision);
+bool ParseFeatPrecision(const std::string & name, FeatPrecision & precision);
+
+inline uint16_t FloatToHalf(float value)
+{
+#if defined(__F16C__)
+  return _cvtss_sh(value, 0);
+#else
+  uint32_t x;
+  memcpy(&x, &value, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  int32_t exp = static_cast<int32_t>((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mant = x & 0x7fffff;
+  if (((x >> 23) & 0xff) == 0xff) {
+    return sign | 0x7c00 | (mant != 0 ? 0x200 : 0);
+  }
+  if (exp >= 0x1f) {
+    return sign | 0x7c00;
+  }
+  uint32_t half;
+  uint32_t rem;
+  uint32_t mid;
+  if (exp <= 0) {
+    // Subnormal half, round the shifted out bits to nearest even
+    if (exp < -10) {
+      return sign;
+    }
+    mant |= 0x800000;
+    uint32_t shift = 14 - exp;
+    half = mant >> shift;
+    rem = mant & ((1U << shift) - 1);
+    mid = 1U << (shift - 1);
+  } else {
+    half = (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+    rem = mant & 0x1fff;
+    mid = 0x1000;
+  }
+  if (rem > mid || (rem == mid && (half & 1))) {
+    half++;
+  }
+  return sign | half;
+#endif
+}
+
+inline float HalfToFloat(uint16_t value)
+{
+#if defined(__F16C__)
+  return _cvtsh_ss(value);
+#else
+  uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  uint32_t exp = (value >> 10) & 0x1f;
+  uint32_t mant = value & 0x3ff;
+  uint32_t x;
+  if (exp == 0) {
+    if (mant == 0) {
+      x = sign;
+    } else {
+      exp = 127 - 15 + 1;
+      while ((mant & 0x400) == 0) {
+        mant <<= 1;
+        exp--;
+      }
+      x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+  } else if (exp == 0x1f) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else {
+    x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  }
+  float result;
+  memcpy(&result, &x, sizeof(result));
+  return result;
+#endif
+}
+
+// Dot product of a float query with a row stored as halfs
+inline float DotHalf(const float * a, const uint16_t * b, size_t len)
+{
+  size_t i = 0;
+  float sum = 0.f;
+#if defined(__AVX2__) && defined(__F16C__)
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (; i + 16 <= len; i += 16) {
+    __m256 b0 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+    __m256 b1 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i + 8)));
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), b0));
+    acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), b1));
+  }
+  for (; i + 8 <= len; i += 8) {
+    __m256 b0 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), b0));
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 0x55));
+  sum = _mm_cvtss_f32(half);
+#elif defined(__aarch64__)
+  float32x4_t acc0 = vdupq_n_f32(0.f);
+  float32x4_t acc1 = vdupq_n_f32(0.f);
+  for (; i + 8 <= len; i += 8) {
+    float32x4_t b0 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(b + i)));
+    float32x4_t b1 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(b + i + 4)));
+    acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), b0);
+    acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), b1);
+  }
+  acc0 = vaddq_f32(acc0, acc1);
+  float32x2_t pair = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+  sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+  for (; i < len; ++i) {
+    sum += a[i] * HalfToFloat(b[i]);
+  }
+  return sum;
+}
+
+// Dot product of a float query with raw int8 codes, scale and offset are
+// applied by the caller
+inline float DotInt8(const float * a, const int8_t * b, size_t len)
+{
+  size_t i = 0;
+  float sum = 0.f;
+#if defined(__AVX2__)
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (; i + 16 <= len; i += 16) {
+    __m128i codes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    __m256 b0 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(codes));
+    __m256 b1 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(codes, 8)));
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), b0));
+    acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), b1));
+  }
+  for (; i + 8 <= len; i += 8) {
+    __m128i codes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(b + i));
+    __m256 b0 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(codes));
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), b0));
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 0x55));
+  sum = _mm_cvtss_f32(half);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  float32x4_t acc0 = vdupq_n_f32(0.f);
+  float32x4_t acc1 = vdupq_n_f32(0.f);
+  for (; i + 8 <= len; i += 8) {
+    int16x8_t codes = vmovl_s8(vld1_s8(b + i));
+    float32x4_t b0 = vcvtq_f32_s32(vmovl_s16(vget_low_s16(codes)));
+    float32x4_t b1 = vcvtq_f32_s32(vmovl_s16(vget_high_s16(codes)));
+    acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), b0);
+    acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), b1);
+  }
+  acc0 = vaddq_f32(acc0, acc1);
+  float32x2_t pair = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+  sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+  for (; i < len; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+inline float Sum(const float * a, size_t len)
+{
+  float sum = 0.f;
+  for (size_t i = 0; i < len; ++i) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+// Score drift of a quantized gallery against its float original
+struct QuantReport
+{
+  size_t probes;
+  float mean_delta;
+  float max_delta;
+  // Share of probes whose best match did not change
+  float top1_agree;
+  QuantReport()
+  {
+    probes = 0;
+    mean_delta = 0.f;
+    max_delta = 0.f;
+    top1_agree = 1.f;
+  }
+};
+
+// Matrix of feature rows of a fixed stride in one of the precisions. Int8
+// rows carry their own scale and offset, a value is scale * code + offset,
+// so a dot product is scale * DotInt8 + offset * sum of the query. Only the
+// first dim values of a row are meaningful, the query has to be zero past
+// them.
+class FeatureRows
+{
+public:
+  FeatureRows();
+
+  // Drop all rows and take a new layout
+  void Reset(FeatPrecision precision, size_t stride);
+  // Requantize the rows kept to another precision
+  void Convert(FeatPrecision precision);
+  void Resize(size_t rows);
+  // Rows laid out with the stride, count rows in one go
+  void Assign(const float * rows, size_t count);
+  void Set(size_t row, const float * feat);
+  void Get(size_t row, float * feat) const;
+  void Move(size_t from, size_t to);
+  // query_sum is only used by int8 rows, see Sum()
+  float Dot(const float * query, float query_sum, size_t row) const;
+
+  FeatPrecision Precision() const;
+  size_t Rows() const;
+  size_t Stride() const;
+  size_t Bytes() const;
+  // Float rows, nullptr once quantized
+  const float * Data() const;
+
+private:
+  FeatPrecision precision_;
+  size_t stride_;
+  size_t rows_;
+  AlignedFloats fp32_;
+  std::vector<uint16_t, AlignedAllocator<uint16_t>> fp16_;
+  std::vector<int8_t, AlignedAllocator<int8_t>> int8_;
+  std::vector<float> scales_;
+  std::vector<float> offsets_;
+};
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__FEATURE_QUANT_HPP_
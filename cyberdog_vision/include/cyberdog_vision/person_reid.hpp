@@ -15,11 +15,16 @@
 #ifndef CYBERDOG_VISION__PERSON_REID_HPP_
 #define CYBERDOG_VISION__PERSON_REID_HPP_
 
+#include <stdint.h>
+
 #include <string>
 #include <vector>
+#include <memory>
+#include <chrono>
 
 #include "ReIDToolAPI.h"
 #include "common_type.hpp"
+#include "reid_gallery.hpp"
 
 namespace cyberdog_vision
 {
@@ -31,38 +36,128 @@ enum SimType
   kSimGroup2Group
 };
 
+// One selected person, its gallery and the motion of its box. A target
+// missed for too long keeps its gallery and is only searched now and then
+// until it is found again or recover time runs out.
+struct ReIDTarget
+{
+  int id;
+  int unmatch_count;
+  bool motion_ready;
+  bool recovering;
+  std::chrono::steady_clock::time_point lost_time;
+  std::unique_ptr<ReIDGalleryBase> gallery;
+  cv::Rect last_tracked;
+  cv::KalmanFilter motion;
+};
+
+// Body of the frame matched to a target
+struct ReIDMatch
+{
+  int id;
+  size_t body_index;
+  float sim;
+  cv::Rect box;
+};
+
 class PersonReID
 {
 public:
   explicit PersonReID(const std::string & model_path);
   ~PersonReID();
 
+  // Drop all targets and follow this body alone
   int SetTracker(const cv::Mat & img, const cv::Rect & body_box, std::vector<float> & reid_feat);
+  // Follow this body as well, up to the max targets
+  int AddTracker(
+    const cv::Mat & img, const cv::Rect & body_box, int & id,
+    std::vector<float> & reid_feat);
+  // Result of the first target still followed
   int GetReIDInfo(
     const cv::Mat & img, const std::vector<InferBbox> & body_bboxes, int & id,
     cv::Rect & tracked);
+  // Results of all targets, every body is extracted once and assigned to at
+  // most one target
+  int GetReIDInfos(
+    const cv::Mat & img, const std::vector<InferBbox> & body_bboxes,
+    std::vector<ReIDMatch> & matches);
   int GetFeatureLen();
   void ResetTracker();
   bool GetLostStatus();
+  // Most bodies extracted per frame, the ones nearest the target go first
+  void SetMaxCrops(int max_crops);
+  // Unmatched frames after which bodies outside the motion gate are
+  // searched again, 0 turns the gate off
+  void SetGateMisses(int gate_misses);
+  void SetMaxTargets(int max_targets);
+  // Seconds a lost target is searched before its gallery goes, every
+  // interval frames, optionally only among bodies not rejected before
+  void SetRecovery(double recover_sec, int recover_interval, bool new_only);
+  // Gallery rows per target, the row a full gallery replaces and the
+  // precision the rows are held in, applies to targets set from now on
+  void SetGallery(
+    int library_frame_num, GalleryPolicy policy,
+    FeatPrecision precision = kFeatFp32);
+  int GetMaxTargets();
+  // Store the gallery of the first target under a person name
+  int SaveGallery(const std::string & name);
+  // Follow a stored person, it is searched like a lost target until found
+  int LoadGallery(const std::string & name, int & id);
+  // Id of the first target still followed, -1 without any
+  int GetPrimaryId();
 
 private:
   int GetFeature(const cv::Mat & img, const cv::Rect & body_box, std::vector<float> & reid_feat);
+  // Features of all boxes, one sdk call per box as the sdk takes no batch.
+  // Boxes are clipped to the image and the ones fully outside get an empty feature.
+  int GetFeatures(
+    const cv::Mat & img, const std::vector<cv::Rect> & boxes,
+    std::vector<std::vector<float>> & feats);
+  // Gate of a target, it opens fully once missed gate_misses_ frames
+  bool InGate(const ReIDTarget & target, const cv::Rect & box) const;
+  // Whether the target is compared with the body this frame
+  bool IsCandidate(const ReIDTarget & target, const cv::Rect & box, bool scan) const;
+  // Move targets missed too long to recovery and purge expired ones
+  void UpdateLost();
+  void SelectCandidates(
+    const std::vector<InferBbox> & body_bboxes,
+    std::vector<size_t> & candidates);
+  // Constant velocity model of the target box center, size kept constant
+  void InitMotion(ReIDTarget & target, const cv::Rect & box);
+  void PredictMotion(ReIDTarget & target);
+  void CorrectMotion(ReIDTarget & target, const cv::Rect & box);
+  float GateDistance(const ReIDTarget & target, const cv::Rect & box) const;
+  cv::Point2f TargetCenter(const ReIDTarget & target) const;
+  // Similarity of detected features to the target gallery
   float GetSim(
-    std::vector<float> & feat_det,
-    std::vector<float> & feat_library, const SimType & sim_type);
+    const ReIDTarget & target, const std::vector<float> & feat_det,
+    const SimType & sim_type);
 
   int gpu_id_;
   int tracking_id_;
   int object_loss_th_;
   int library_frame_num_;
-  int unmatch_count_;
+  int feat_len_;
+  uint32_t model_tag_;
+  int max_crops_;
+  int max_targets_;
+  int gate_misses_;
+  int recover_interval_;
+  uint64_t frame_count_;
+  double recover_sec_;
   float feat_sim_th_;
   float feat_update_th_;
   bool is_tracking_;
   bool is_lost_;
+  bool recover_new_only_;
+  GalleryPolicy gallery_policy_;
+  FeatPrecision gallery_precision_;
 
   void * reid_ptr_;
-  std::vector<float> tracker_feat_;
+  std::vector<ReIDTarget> targets_;
+  // Bodies the last recovery scan compared and turned down
+  std::vector<cv::Rect> rejected_;
+  std::vector<uint8_t> crop_buf_;
 };
 
 }  // namespace cyberdog_vision
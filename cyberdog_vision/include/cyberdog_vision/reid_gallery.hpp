@@ -0,0 +1,437 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__REID_GALLERY_HPP_
+#define CYBERDOG_VISION__REID_GALLERY_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "cyberdog_vision/feature_ops.hpp"
+#include "cyberdog_vision/feature_quant.hpp"
+
+namespace cyberdog_vision
+{
+
+// Cosine similarity of two features of len floats
+inline float Cosine(const float * a, const float * b, size_t len)
+{
+  float ab = Dot(a, b, len);
+  float aa = Dot(a, a, len);
+  float bb = Dot(b, b, len);
+  return aa > 0.f && bb > 0.f ? ab / sqrtf(aa * bb) : 0.f;
+}
+
+// Row replaced once a gallery is full
+enum GalleryPolicy
+{
+  kGalleryFifo = 0,
+  // Keep the rows far apart, the new row replaces one of the closest pair
+  kGalleryDiverse
+};
+
+inline bool ParseGalleryPolicy(const std::string & name, GalleryPolicy & policy)
+{
+  if (name == "fifo") {
+    policy = kGalleryFifo;
+  } else if (name == "diverse") {
+    policy = kGalleryDiverse;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Appearance features of one target, a row is replaced once full
+class ReIDGalleryBase
+{
+public:
+  virtual ~ReIDGalleryBase() {}
+
+  virtual std::unique_ptr<ReIDGalleryBase> Clone() const = 0;
+  virtual void Clear() = 0;
+  // Stamp is the wall time of the feature in nanoseconds
+  virtual void Push(const float * feat, int64_t stamp_ns) = 0;
+  // Requantize the rows kept, later pushes keep the precision
+  virtual void SetPrecision(FeatPrecision precision) = 0;
+  virtual FeatPrecision Precision() const = 0;
+  // Memory held by the rows
+  virtual size_t Bytes() const = 0;
+  virtual size_t Size() const = 0;
+  virtual size_t Capacity() const = 0;
+  virtual size_t Dim() const = 0;
+  // Copy out the Dim() floats of a row, dequantized when stored quantized,
+  // rows are normalized and in no particular order
+  virtual void Get(size_t index, float * feat) const = 0;
+  virtual int64_t Stamp(size_t index) const = 0;
+  // Row written by the last push, as stored
+  virtual const float * Newest() const = 0;
+  // Mean cosine of a feature to every feature of the gallery
+  virtual float One2Group(const float * feat) const = 0;
+  // Mean cosine over all pairs of count features and the gallery
+  virtual float Group2Group(const float * feats, size_t count) const = 0;
+  // Rows back to back, the flat layout of the sdk similarity calls
+  void CopyTo(std::vector<float> & feats) const
+  {
+    feats.resize(Size() * Dim());
+    for (size_t i = 0; i < Size(); ++i) {
+      Get(i, &feats[i * Dim()]);
+    }
+  }
+};
+
+// Normalized feature rows with a running sum, so a one to group similarity
+// is a single dot product with the sum. Once full a push replaces the
+// oldest row, or under kGalleryDiverse the older row of the most similar
+// pair, keeping the pairwise cosines of the rows to find it. A new row
+// closer to a kept one than any pair only refreshes that row. DIM fixes
+// the feature length at compile time, 0 takes it at runtime. Rows may be
+// held as fp16 or int8, the sum is built from the stored values so every
+// score sees the rows as kept.
+template<size_t DIM>
+class ReIDGallery : public ReIDGalleryBase
+{
+public:
+  explicit ReIDGallery(size_t capacity, GalleryPolicy policy = kGalleryFifo, size_t dim = DIM)
+  : capacity_(std::max(capacity, static_cast<size_t>(1))), policy_(policy),
+    dim_(DIM > 0 ? DIM : dim), stride_(AlignedStride(dim_)), sum_(stride_, 0.f),
+    query_(stride_, 0.f), scratch_(stride_, 0.f), row_(stride_, 0.f), newest_feat_(stride_, 0.f),
+    seqs_(capacity_, 0), stamps_(capacity_, 0), new_sims_(capacity_, 0.f)
+  {
+    feats_.Reset(kFeatFp32, stride_);
+    feats_.Resize(capacity_);
+    if (policy_ == kGalleryDiverse) {
+      sims_.assign(capacity_ * capacity_, 0.f);
+    }
+    Clear();
+  }
+
+  std::unique_ptr<ReIDGalleryBase> Clone() const override
+  {
+    return std::unique_ptr<ReIDGalleryBase>(new ReIDGallery<DIM>(*this));
+  }
+
+  void Clear() override
+  {
+    count_ = 0;
+    newest_ = 0;
+    pushes_ = 0;
+    std::fill(sum_.begin(), sum_.end(), 0.f);
+    std::fill(newest_feat_.begin(), newest_feat_.end(), 0.f);
+  }
+
+  void Push(const float * feat, int64_t stamp_ns) override
+  {
+    memcpy(scratch_.data(), feat, sizeof(float) * Len());
+    L2Normalize(scratch_.data(), Len());
+    if (policy_ == kGalleryDiverse) {
+      float scratch_sum = Sum(scratch_.data(), Len());
+      for (size_t i = 0; i < count_; ++i) {
+        new_sims_[i] = RowDot(scratch_.data(), scratch_sum, i);
+      }
+    }
+
+    size_t slot;
+    if (count_ < capacity_) {
+      slot = count_++;
+    } else {
+      slot = policy_ == kGalleryDiverse ? Redundant() : Oldest();
+      feats_.Get(slot, row_.data());
+      for (size_t d = 0; d < Len(); ++d) {
+        sum_[d] -= row_[d];
+      }
+    }
+    feats_.Set(slot, scratch_.data());
+    feats_.Get(slot, newest_feat_.data());
+    for (size_t d = 0; d < Len(); ++d) {
+      sum_[d] += newest_feat_[d];
+    }
+    seqs_[slot] = ++pushes_;
+    stamps_[slot] = stamp_ns;
+    newest_ = slot;
+    if (policy_ == kGalleryDiverse) {
+      for (size_t i = 0; i < count_; ++i) {
+        sims_[slot * capacity_ + i] = i == slot ? 1.f : new_sims_[i];
+        sims_[i * capacity_ + slot] = sims_[slot * capacity_ + i];
+      }
+    }
+
+    // Rebuild the sum now and then to bound rounding drift
+    if (pushes_ % (kResyncRounds * capacity_) == 0) {
+      Resync();
+    }
+  }
+
+  void SetPrecision(FeatPrecision precision) override
+  {
+    if (precision == feats_.Precision()) {
+      return;
+    }
+    feats_.Convert(precision);
+    Resync();
+    if (count_ > 0) {
+      feats_.Get(newest_, newest_feat_.data());
+    }
+  }
+
+  FeatPrecision Precision() const override
+  {
+    return feats_.Precision();
+  }
+
+  size_t Bytes() const override
+  {
+    return feats_.Bytes();
+  }
+
+  size_t Size() const override
+  {
+    return count_;
+  }
+
+  size_t Capacity() const override
+  {
+    return capacity_;
+  }
+
+  size_t Dim() const override
+  {
+    return Len();
+  }
+
+  void Get(size_t index, float * feat) const override
+  {
+    feats_.Get(index, row_.data());
+    memcpy(feat, row_.data(), sizeof(float) * Len());
+  }
+
+  int64_t Stamp(size_t index) const override
+  {
+    return stamps_[index];
+  }
+
+  const float * Newest() const override
+  {
+    return newest_feat_.data();
+  }
+
+  float One2Group(const float * feat) const override
+  {
+    if (count_ == 0) {
+      return 0.f;
+    }
+    float norm = sqrtf(Dot(feat, feat, Len()));
+    if (norm <= 0.f) {
+      return 0.f;
+    }
+    return Dot(feat, sum_.data(), Len()) / (norm * count_);
+  }
+
+  float Group2Group(const float * feats, size_t count) const override
+  {
+    if (count_ == 0 || count == 0) {
+      return 0.f;
+    }
+    std::fill(query_.begin(), query_.end(), 0.f);
+    for (size_t i = 0; i < count; ++i) {
+      const float * feat = feats + i * Len();
+      float norm = sqrtf(Dot(feat, feat, Len()));
+      if (norm <= 0.f) {
+        continue;
+      }
+      float inv = 1.f / norm;
+      for (size_t d = 0; d < Len(); ++d) {
+        query_[d] += feat[d] * inv;
+      }
+    }
+    return Dot(query_.data(), sum_.data(), Len()) / (count * count_);
+  }
+
+private:
+  static const size_t kResyncRounds = 64;
+
+  // Constant for the fixed sizes so the kernels unroll
+  size_t Len() const
+  {
+    return DIM > 0 ? DIM : dim_;
+  }
+
+  // Dot of a query zero past Len() with a stored row, query_sum is the sum
+  // of the query for int8 rows
+  float RowDot(const float * query, float query_sum, size_t index) const
+  {
+    const float * rows = feats_.Data();
+    if (rows != nullptr) {
+      return Dot(query, rows + index * stride_, Len());
+    }
+    return feats_.Dot(query, query_sum, index);
+  }
+
+  void Resync()
+  {
+    std::fill(sum_.begin(), sum_.end(), 0.f);
+    for (size_t i = 0; i < count_; ++i) {
+      feats_.Get(i, row_.data());
+      for (size_t d = 0; d < Len(); ++d) {
+        sum_[d] += row_[d];
+      }
+    }
+  }
+
+  size_t Oldest() const
+  {
+    size_t oldest = 0;
+    for (size_t i = 1; i < count_; ++i) {
+      if (seqs_[i] < seqs_[oldest]) {
+        oldest = i;
+      }
+    }
+    return oldest;
+  }
+
+  // Row the new one in scratch_ replaces, new_sims_ holds its cosines
+  size_t Redundant() const
+  {
+    size_t nearest = 0;
+    for (size_t i = 1; i < count_; ++i) {
+      if (new_sims_[i] > new_sims_[nearest]) {
+        nearest = i;
+      }
+    }
+    size_t pair_a = 0;
+    size_t pair_b = 0;
+    float pair_sim = -2.f;
+    for (size_t i = 0; i < count_; ++i) {
+      for (size_t j = i + 1; j < count_; ++j) {
+        if (sims_[i * capacity_ + j] > pair_sim) {
+          pair_sim = sims_[i * capacity_ + j];
+          pair_a = i;
+          pair_b = j;
+        }
+      }
+    }
+    if (new_sims_[nearest] >= pair_sim) {
+      return nearest;
+    }
+    return seqs_[pair_a] < seqs_[pair_b] ? pair_a : pair_b;
+  }
+
+  size_t capacity_;
+  GalleryPolicy policy_;
+  size_t dim_;
+  size_t stride_;
+  size_t count_;
+  size_t newest_;
+  uint64_t pushes_;
+  FeatureRows feats_;
+  AlignedFloats sum_;
+  mutable AlignedFloats query_;
+  AlignedFloats scratch_;
+  mutable AlignedFloats row_;
+  // Newest row as stored, the one to one similarity reads it directly
+  AlignedFloats newest_feat_;
+  std::vector<uint64_t> seqs_;
+  std::vector<int64_t> stamps_;
+  std::vector<float> new_sims_;
+  // Cosine of every pair of rows, kGalleryDiverse only
+  std::vector<float> sims_;
+};
+
+// Fixed size gallery for the common feature lengths, runtime otherwise
+inline std::unique_ptr<ReIDGalleryBase> MakeReIDGallery(
+  size_t dim, size_t capacity,
+  GalleryPolicy policy = kGalleryFifo, FeatPrecision precision = kFeatFp32)
+{
+  std::unique_ptr<ReIDGalleryBase> gallery;
+  switch (dim) {
+    case 128:
+      gallery.reset(new ReIDGallery<128>(capacity, policy));
+      break;
+    case 256:
+      gallery.reset(new ReIDGallery<256>(capacity, policy));
+      break;
+    case 512:
+      gallery.reset(new ReIDGallery<512>(capacity, policy));
+      break;
+    default:
+      gallery.reset(new ReIDGallery<0>(capacity, policy, dim));
+      break;
+  }
+  gallery->SetPrecision(precision);
+  return gallery;
+}
+
+// Probe the quantized gallery with the rows of the float one it was
+// converted from. Deltas are of the one to group score, top1_agree is the
+// share of probes whose nearest other row did not change, the pair the
+// diverse policy replaces by.
+inline void MeasureQuantError(
+  const ReIDGalleryBase & reference, const ReIDGalleryBase & quantized,
+  QuantReport & report)
+{
+  report = QuantReport();
+  if (reference.Size() != quantized.Size() || reference.Dim() != quantized.Dim() ||
+    reference.Size() == 0)
+  {
+    return;
+  }
+
+  size_t dim = reference.Dim();
+  std::vector<float> probe(dim);
+  std::vector<float> ref_row(dim);
+  std::vector<float> quant_row(dim);
+  float sum_delta = 0.f;
+  size_t agree = 0;
+  for (size_t i = 0; i < reference.Size(); ++i) {
+    reference.Get(i, probe.data());
+    float delta = fabsf(reference.One2Group(probe.data()) - quantized.One2Group(probe.data()));
+    sum_delta += delta;
+    report.max_delta = std::max(report.max_delta, delta);
+
+    int ref_best = -1;
+    int quant_best = -1;
+    float ref_sim = -2.f;
+    float quant_sim = -2.f;
+    for (size_t j = 0; j < reference.Size(); ++j) {
+      if (j == i) {
+        continue;
+      }
+      reference.Get(j, ref_row.data());
+      quantized.Get(j, quant_row.data());
+      float sim = Dot(probe.data(), ref_row.data(), dim);
+      if (sim > ref_sim) {
+        ref_sim = sim;
+        ref_best = j;
+      }
+      sim = Dot(probe.data(), quant_row.data(), dim);
+      if (sim > quant_sim) {
+        quant_sim = sim;
+        quant_best = j;
+      }
+    }
+    agree += ref_best == quant_best;
+    report.probes++;
+  }
+  report.mean_delta = sum_delta / report.probes;
+  report.top1_agree = static_cast<float>(agree) / report.probes;
+}
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__REID_GALLERY_HPP_
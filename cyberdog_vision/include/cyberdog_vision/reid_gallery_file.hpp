@@ -0,0 +1,66 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__REID_GALLERY_FILE_HPP_
+#define CYBERDOG_VISION__REID_GALLERY_FILE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <memory>
+
+#include "cyberdog_vision/reid_gallery.hpp"
+
+namespace cyberdog_vision
+{
+
+const char kReIDGalleryDir[] = "/home/mi/.reid/";
+
+const uint32_t kReIDGalleryVersion = 1;
+
+// Gallery file layout, one file per person name:
+//   ReIDGalleryHeader
+//   count * int64 stamps, wall time of each feature in nanoseconds
+//   count * dim floats, normalized features
+// model_tag identifies the reid engine that extracted the features, files
+// of another engine are removed when read. The checksum is the crc32 of
+// everything following the header.
+struct ReIDGalleryHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t dim;
+  uint32_t count;
+  uint32_t model_tag;
+  uint32_t checksum;
+};
+
+// Tag of an engine file from its size and modification time
+uint32_t ReIDModelTag(const std::string & model_file);
+// File of a named gallery, empty for names that are no plain file name
+std::string ReIDGalleryPath(const std::string & name);
+
+// A quantized gallery has no float original, its rows are saved as kept
+int WriteReIDGallery(
+  const std::string & path, uint32_t model_tag,
+  const ReIDGalleryBase & gallery);
+// Rows are pushed oldest first into a new float gallery of the given
+// capacity
+int ReadReIDGallery(
+  const std::string & path, uint32_t model_tag, size_t capacity,
+  GalleryPolicy policy, std::unique_ptr<ReIDGalleryBase> & gallery);
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__REID_GALLERY_FILE_HPP_
@@ -0,0 +1,147 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CYBERDOG_VISION__RING_STATS_HPP_
+#define CYBERDOG_VISION__RING_STATS_HPP_
+
+#include <math.h>
+#include <stddef.h>
+
+#include <algorithm>
+
+namespace cyberdog_vision
+{
+
+// Mean and variance over the last Window() samples, kept in time order in
+// a ring of compile-time capacity. Each push is a windowed Welford update,
+// the sums are rebuilt from the ring every kResyncPeriod pushes to bound
+// rounding drift.
+template<typename T, size_t CAPACITY>
+class RingStats
+{
+  static_assert(CAPACITY > 0, "RingStats needs a positive capacity");
+
+public:
+  RingStats()
+  : window_(CAPACITY)
+  {
+    Clear();
+  }
+
+  // Clamped to [1, CAPACITY], clears the samples
+  void SetWindow(size_t window)
+  {
+    window_ = std::min(std::max(window, static_cast<size_t>(1)), CAPACITY);
+    Clear();
+  }
+
+  void Clear()
+  {
+    head_ = 0;
+    count_ = 0;
+    pushes_ = 0;
+    mean_ = 0.0;
+    m2_ = 0.0;
+  }
+
+  void Push(const T & value)
+  {
+    double x = static_cast<double>(value);
+    if (count_ < window_) {
+      values_[(head_ + count_) % window_] = value;
+      count_++;
+      double delta = x - mean_;
+      mean_ += delta / count_;
+      m2_ += delta * (x - mean_);
+    } else {
+      // Replace the oldest sample in one step
+      double old = static_cast<double>(values_[head_]);
+      values_[head_] = value;
+      head_ = (head_ + 1) % window_;
+      double mean = mean_ + (x - old) / count_;
+      m2_ += (x - old) * (x - mean + old - mean_);
+      mean_ = mean;
+    }
+    if (++pushes_ % kResyncPeriod == 0) {
+      Resync();
+    }
+    m2_ = std::max(m2_, 0.0);
+  }
+
+  size_t Size() const
+  {
+    return count_;
+  }
+
+  size_t Window() const
+  {
+    return window_;
+  }
+
+  bool Full() const
+  {
+    return count_ == window_;
+  }
+
+  // Index 0 is the oldest sample
+  const T & At(size_t index) const
+  {
+    return values_[(head_ + index) % window_];
+  }
+
+  double Mean() const
+  {
+    return mean_;
+  }
+
+  // Population variance of the window
+  double Variance() const
+  {
+    return count_ > 0 ? m2_ / count_ : 0.0;
+  }
+
+  double Stdev() const
+  {
+    return sqrt(Variance());
+  }
+
+private:
+  static const size_t kResyncPeriod = 64 * CAPACITY;
+
+  void Resync()
+  {
+    double sum = 0.0;
+    for (size_t i = 0; i < count_; ++i) {
+      sum += static_cast<double>(At(i));
+    }
+    mean_ = count_ > 0 ? sum / count_ : 0.0;
+    m2_ = 0.0;
+    for (size_t i = 0; i < count_; ++i) {
+      double delta = static_cast<double>(At(i)) - mean_;
+      m2_ += delta * delta;
+    }
+  }
+
+  T values_[CAPACITY];
+  size_t window_;
+  size_t head_;
+  size_t count_;
+  size_t pushes_;
+  double mean_;
+  double m2_;
+};
+
+}  // namespace cyberdog_vision
+
+#endif  // CYBERDOG_VISION__RING_STATS_HPP_
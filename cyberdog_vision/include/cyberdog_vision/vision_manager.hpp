@@ -42,8 +42,10 @@
 #include "rclcpp_lifecycle/lifecycle_publisher.hpp"
 
 #include "cyberdog_vision/shared_memory_op.hpp"
+#include "cyberdog_vision/detection_history.hpp"
 #include "cyberdog_vision/body_detection.hpp"
 #include "cyberdog_vision/face_recognition.hpp"
+#include "cyberdog_vision/face_track_cache.hpp"
 #include "cyberdog_vision/gesture_recognition.hpp"
 #include "cyberdog_vision/keypoints_detection.hpp"
 #include "cyberdog_vision/person_reid.hpp"
@@ -100,8 +102,9 @@ private:
   void GestureRecognize();
   void KeypointsDet();
 
-  int LoadFaceLibrary(std::map<std::string, std::vector<float>> & library);
-  int GetMatchBody(const sensor_msgs::msg::RegionOfInterest & roi);
+  int GetMatchBody(
+    const sensor_msgs::msg::RegionOfInterest & roi,
+    const builtin_interfaces::msg::Time & stamp);
   void SetAlgoState(const AlgoListT & algo_list, const bool & value);
 
   void TrackingService(
@@ -126,6 +129,9 @@ private:
   void publishFaceResult(
     int result, std::string & face_msg);
 
+  int StartEnroll(const std::string & face_name, bool is_host);
+  void CancelEnroll();
+  void FaceEnrollProc();
   void FaceDetProc(std::string);
 
   void DownloadCallback(const ConnectorStatusT::SharedPtr msg);
@@ -160,6 +166,7 @@ private:
   std::shared_ptr<std::thread> gesture_thread_;
   std::shared_ptr<std::thread> reid_thread_;
   std::shared_ptr<std::thread> keypoints_thread_;
+  std::shared_ptr<std::thread> enroll_thread_;
 
   std::shared_ptr<BodyDetection> body_ptr_;
   std::shared_ptr<FaceRecognition> face_ptr_;
@@ -178,10 +185,10 @@ private:
   std::shared_ptr<CyberdogModelT> keypoints_model_;
   std::shared_ptr<CyberdogModelT> reid_model_;
 
-  std::map<std::string, std::vector<float>> face_library_;
-
   GlobalImageBuf global_img_buf_;
   BodyResults body_results_;
+  FaceTrackCache face_tracks_;
+  std::shared_ptr<const FaceGallery> face_tracks_library_;
 
   AlgoStruct face_struct_;
   AlgoStruct body_struct_;
@@ -189,6 +196,7 @@ private:
   AlgoStruct keypoints_struct_;
   AlgoStruct reid_struct_;
   AlgoStruct focus_struct_;
+  EnrollStruct enroll_;
   AlgoProcess algo_proc_;
 
   std::mutex result_mtx_;
@@ -200,6 +208,7 @@ private:
   int sem_set_id_;
   char * shm_addr_;
 
+  uint64_t frame_id_;
   size_t buf_size_;
   bool open_face_;
   bool open_body_;
@@ -207,9 +216,10 @@ private:
   bool open_keypoints_;
   bool open_reid_;
   bool open_focus_;
+  // Focus tracking runs on body detections, after each of them
+  bool focus_fuse_;
   bool open_face_manager_;
   bool is_activate_;
-  bool face_detect_;
 
   bool main_algo_deactivated_;
   bool depend_deactivated_;
@@ -0,0 +1,104 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+
+#include <limits>
+#include <vector>
+
+#include "cyberdog_vision/assignment.hpp"
+
+namespace cyberdog_vision
+{
+
+float SolveAssignment(const std::vector<std::vector<float>> & cost, std::vector<int> & assign)
+{
+  size_t rows = cost.size();
+  size_t cols = rows > 0 ? cost[0].size() : 0;
+  assign.assign(rows, -1);
+  if (rows == 0 || cols == 0) {
+    return 0.f;
+  }
+
+  // The method wants no more rows than columns, solve the transpose otherwise
+  bool transposed = rows > cols;
+  size_t n = transposed ? cols : rows;
+  size_t m = transposed ? rows : cols;
+  auto at = [&](size_t i, size_t j) {
+      return static_cast<double>(transposed ? cost[j][i] : cost[i][j]);
+    };
+
+  // Potentials u, v and the row matched to each column, 1 based with column
+  // 0 as the free root of the augmenting path
+  const double inf = std::numeric_limits<double>::max();
+  std::vector<double> u(n + 1, 0.), v(m + 1, 0.);
+  std::vector<size_t> match(m + 1, 0), way(m + 1, 0);
+  for (size_t i = 1; i <= n; ++i) {
+    match[0] = i;
+    size_t j0 = 0;
+    std::vector<double> min_slack(m + 1, inf);
+    std::vector<bool> used(m + 1, false);
+    do {
+      used[j0] = true;
+      size_t i0 = match[j0];
+      size_t j1 = 0;
+      double delta = inf;
+      for (size_t j = 1; j <= m; ++j) {
+        if (used[j]) {
+          continue;
+        }
+        double slack = at(i0 - 1, j - 1) - u[i0] - v[j];
+        if (slack < min_slack[j]) {
+          min_slack[j] = slack;
+          way[j] = j0;
+        }
+        if (min_slack[j] < delta) {
+          delta = min_slack[j];
+          j1 = j;
+        }
+      }
+      for (size_t j = 0; j <= m; ++j) {
+        if (used[j]) {
+          u[match[j]] += delta;
+          v[j] -= delta;
+        } else {
+          min_slack[j] -= delta;
+        }
+      }
+      j0 = j1;
+    } while (match[j0] != 0);
+    do {
+      size_t j1 = way[j0];
+      match[j0] = match[j1];
+      j0 = j1;
+    } while (j0 != 0);
+  }
+
+  float total = 0.f;
+  for (size_t j = 1; j <= m; ++j) {
+    if (match[j] == 0) {
+      continue;
+    }
+    size_t i = match[j] - 1;
+    if (transposed) {
+      assign[j - 1] = static_cast<int>(i);
+    } else {
+      assign[i] = static_cast<int>(j - 1);
+    }
+    total += static_cast<float>(at(i, j - 1));
+  }
+  return total;
+}
+
+}  // namespace cyberdog_vision
@@ -12,8 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <math.h>
+
 #include <string>
 #include <memory>
+#include <vector>
+#include <algorithm>
 
 #include "cyberdog_vision/auto_track.hpp"
 #include "cyberdog_vision/common_type.hpp"
@@ -22,8 +26,69 @@
 namespace cyberdog_vision
 {
 
+// Overlap of the target with a detection to take the detection
+const float kSnapIoU = 0.5;
+// Overlap of a second detection that makes the choice ambiguous
+const float kAmbiguousIoU = 0.3;
+// Overlap of the siamese box with its detection below which the siamese
+// template restarts from the detection
+const float kReinitIoU = 0.7;
+// Failed frames before the target is searched instead of tracked
+const int kSearchAfterFails = 10;
+// Frames between two searches
+const int kSearchInterval = 5;
+// Histogram correlation of a detection to take it as the target again
+const double kReacquireSim = 0.7;
+// Lead of the best correlation over the second one that takes a detection
+// away from where the target was lost
+const double kReacquireMargin = 0.15;
+// Height ratio of a detection to the lost target beyond which it is
+// someone else at another depth
+const float kReacquireScale = 2.f;
+// Distance from where the target was lost in box heights, it grows with
+// every failed frame
+const float kReacquireReach = 1.f;
+const float kReacquireSpread = 0.05f;
+// Weight of the newest confident look in the target histogram
+const float kHistRate = 0.1f;
+// Search window side over the box side
+const float kWindowRatio = 3.f;
+// Frames of motion the window leaves room for
+const float kWindowMotion = 5.f;
+// Longer box side in the tracker input, larger targets are downscaled
+const float kMaxTargetSide = 160.f;
+// Size change of the target against its window that moves the window
+const float kWindowRescale = 1.5f;
+// Side of the square crop kept around the template over the longer box side,
+// it covers the context the siamese template reads
+const float kTemplateContext = 2.f;
+
+// Hue and saturation histogram of the inner part of a box, the border
+// mostly holds background
+static void BoxHist(const cv::Mat & img, const cv::Rect & box, cv::Mat & hist)
+{
+  cv::Rect inner(
+    box.x + box.width / 5, box.y + box.height / 5, box.width * 3 / 5,
+    box.height * 3 / 5);
+  inner = ClampRect(inner, img);
+  if (inner.area() == 0) {
+    hist.release();
+    return;
+  }
+  cv::Mat hsv;
+  cv::cvtColor(img(inner), hsv, cv::COLOR_BGR2HSV);
+  int channels[] = {0, 1};
+  int bins[] = {16, 16};
+  float hue_range[] = {0, 180};
+  float sat_range[] = {0, 256};
+  const float * ranges[] = {hue_range, sat_range};
+  cv::calcHist(&hsv, 1, channels, cv::Mat(), hist, 2, bins, ranges);
+  cv::normalize(hist, hist, 1, 0, cv::NORM_L1);
+}
+
 AutoTrack::AutoTrack(const std::string & model_path)
-: gpu_id_(0), loss_th_(300), fail_count_(0), is_init_(false), is_lost_(false)
+: window_scale_(1.f), gpu_id_(0), loss_th_(300), fail_count_(0), search_count_(0), is_init_(false),
+  is_lost_(false), is_stale_(false), is_searching_(false)
 {
   INFO("===Init AutoTrack===");
   std::string backbone_path = model_path + "/test_backbone.onnx";
@@ -43,18 +108,182 @@ bool AutoTrack::SetTracker(const cv::Mat & img, const cv::Rect & bbox)
     return false;
   }
 
-  XMImage xm_img;
-  ImgConvert(img, xm_img);
   fail_count_ = 0;
-  bool is_success = tracker_ptr_->init(xm_img, bbox);
+  velocity_ = cv::Point2f(0.f, 0.f);
+  bool is_success = InitTracker(img, bbox);
   if (is_success) {
+    BoxHist(img, bbox, target_hist_);
     is_init_ = true;
     is_lost_ = false;
+    is_searching_ = false;
     INFO("Set auto track success.");
   }
   return is_success;
 }
 
+bool AutoTrack::InitTracker(const cv::Mat & img, const cv::Rect & bbox)
+{
+  MakeWindow(img, bbox, window_, window_scale_);
+  XMImage xm_img;
+  ImgConvert(WindowImage(img), xm_img);
+  if (!tracker_ptr_->init(xm_img, ToWindow(bbox))) {
+    return false;
+  }
+  // Keep the crop the template came from, window moves restart from it
+  float side = std::max(bbox.width, bbox.height) * kTemplateContext;
+  cv::Rect crop = ClampRect(
+    cv::Rect(
+      cvRound(bbox.x + bbox.width / 2.f - side / 2.f),
+      cvRound(bbox.y + bbox.height / 2.f - side / 2.f), cvRound(side), cvRound(side)), img);
+  img(crop).copyTo(template_img_);
+  template_box_ = bbox - crop.tl();
+  last_box_ = bbox;
+  last_img_ = img;
+  is_stale_ = false;
+  return true;
+}
+
+bool AutoTrack::MoveWindow(const cv::Mat & img)
+{
+  if (template_img_.empty() || template_box_.area() == 0 || last_box_.area() == 0) {
+    return InitTracker(last_img_, last_box_);
+  }
+  MakeWindow(img, last_box_, window_, window_scale_);
+  cv::Rect box = ToWindow(last_box_);
+  if (box.area() == 0) {
+    return false;
+  }
+
+  // The template crop is scaled onto the last box in an otherwise blank
+  // window, only the context around the box reaches the template
+  float scale_x = static_cast<float>(box.width) / template_box_.width;
+  float scale_y = static_cast<float>(box.height) / template_box_.height;
+  cv::Mat crop;
+  cv::resize(
+    template_img_, crop, cv::Size(
+      std::max(1, cvRound(template_img_.cols * scale_x)),
+      std::max(1, cvRound(template_img_.rows * scale_y))));
+  cv::Mat canvas = cv::Mat::zeros(
+    std::max(1, cvRound(window_.height * window_scale_)),
+    std::max(1, cvRound(window_.width * window_scale_)), template_img_.type());
+  cv::Point offset(
+    box.x - cvRound(template_box_.x * scale_x), box.y - cvRound(template_box_.y * scale_y));
+  cv::Rect paste = cv::Rect(offset, crop.size()) & cv::Rect(0, 0, canvas.cols, canvas.rows);
+  if (paste.area() == 0) {
+    return false;
+  }
+  crop(paste - offset).copyTo(canvas(paste));
+  XMImage xm_img;
+  ImgConvert(canvas, xm_img);
+  return tracker_ptr_->init(xm_img, box);
+}
+
+void AutoTrack::MakeWindow(
+  const cv::Mat & img, const cv::Rect & box, cv::Rect & window,
+  float & scale)
+{
+  // A search covers the whole frame
+  if (is_searching_ || box.area() == 0) {
+    window = cv::Rect(0, 0, img.cols, img.rows);
+    scale = 1.f;
+    return;
+  }
+  float width = box.width * kWindowRatio + 2.f * fabsf(velocity_.x) * kWindowMotion;
+  float height = box.height * kWindowRatio + 2.f * fabsf(velocity_.y) * kWindowMotion;
+  float cx = box.x + box.width / 2.f;
+  float cy = box.y + box.height / 2.f;
+  window = ClampRect(
+    cv::Rect(
+      cvRound(cx - width / 2.f), cvRound(cy - height / 2.f), cvRound(width),
+      cvRound(height)), img);
+  scale = std::min(1.f, kMaxTargetSide / std::max(box.width, box.height));
+}
+
+bool AutoTrack::NeedWindow(const cv::Mat & img)
+{
+  if (window_.area() == 0 || window_.br().x > img.cols || window_.br().y > img.rows) {
+    return true;
+  }
+  cv::Rect window;
+  float scale;
+  MakeWindow(img, last_box_, window, scale);
+  if (scale * kWindowRescale < window_scale_ || scale > window_scale_ * kWindowRescale ||
+    window.area() * kWindowRescale * kWindowRescale < window_.area())
+  {
+    return true;
+  }
+
+  // Half a box of room around where the target goes next
+  cv::Rect next(
+    cvRound(last_box_.x + velocity_.x - last_box_.width / 2.f),
+    cvRound(last_box_.y + velocity_.y - last_box_.height / 2.f), last_box_.width * 2,
+    last_box_.height * 2);
+  next = ClampRect(next, img);
+  return (next & window_) != next;
+}
+
+const cv::Mat & AutoTrack::WindowImage(const cv::Mat & img)
+{
+  if (window_ == cv::Rect(0, 0, img.cols, img.rows) && window_scale_ >= 1.f &&
+    img.isContinuous())
+  {
+    return img;
+  }
+  if (window_scale_ < 1.f) {
+    cv::Size size(
+      std::max(1, cvRound(window_.width * window_scale_)),
+      std::max(1, cvRound(window_.height * window_scale_)));
+    cv::resize(img(window_), window_img_, size, 0, 0, cv::INTER_AREA);
+  } else {
+    img(window_).copyTo(window_img_);
+  }
+  return window_img_;
+}
+
+cv::Rect AutoTrack::ToWindow(const cv::Rect & rect)
+{
+  return cv::Rect(
+    cvRound((rect.x - window_.x) * window_scale_), cvRound((rect.y - window_.y) * window_scale_),
+    cvRound(rect.width * window_scale_), cvRound(rect.height * window_scale_));
+}
+
+cv::Rect AutoTrack::ToFrame(const cv::Rect & rect)
+{
+  return cv::Rect(
+    window_.x + cvRound(rect.x / window_scale_), window_.y + cvRound(rect.y / window_scale_),
+    cvRound(rect.width / window_scale_), cvRound(rect.height / window_scale_));
+}
+
+void AutoTrack::UpdateHist(const cv::Mat & img, const cv::Rect & box)
+{
+  cv::Mat hist;
+  BoxHist(img, box, hist);
+  if (hist.empty()) {
+    return;
+  }
+  if (target_hist_.empty()) {
+    target_hist_ = hist;
+    return;
+  }
+  // A look far off the target is mostly an occluder, keep it out
+  if (cv::compareHist(target_hist_, hist, cv::HISTCMP_CORREL) < kReacquireSim) {
+    return;
+  }
+  cv::addWeighted(target_hist_, 1.f - kHistRate, hist, kHistRate, 0., target_hist_);
+}
+
+void AutoTrack::UpdateBox(const cv::Mat & img, const cv::Rect & box)
+{
+  if (last_box_.area() > 0) {
+    cv::Point2f shift(
+      box.x + box.width / 2.f - last_box_.x - last_box_.width / 2.f,
+      box.y + box.height / 2.f - last_box_.y - last_box_.height / 2.f);
+    velocity_ = velocity_ * 0.5f + shift * 0.5f;
+  }
+  last_box_ = box;
+  last_img_ = img;
+}
+
 bool AutoTrack::Track(const cv::Mat & img, cv::Rect & bbox)
 {
   if (img.empty()) {
@@ -67,24 +296,195 @@ bool AutoTrack::Track(const cv::Mat & img, cv::Rect & bbox)
     return false;
   }
 
+  // No detections to search, the siamese search only runs now and then
+  if (is_searching_ && ++search_count_ % kSearchInterval != 0) {
+    CountFail();
+    return false;
+  }
+
+  // Move the window with the target, the template stays the original one
+  if (NeedWindow(img) && !MoveWindow(img)) {
+    WARN("Move auto track window fail. ");
+  }
+
   XMImage xm_img;
-  ImgConvert(img, xm_img);
+  ImgConvert(WindowImage(img), xm_img);
   tracker_ptr_->track(xm_img);
   TRACKER::TrackBox track_box = tracker_ptr_->getBox();
   if (!track_box.track_sucess) {
-    fail_count_++;
-    if (fail_count_ > loss_th_) {
-      WARN("Object lost, please set tracker to restart. ");
-      is_init_ = false;
-      is_lost_ = true;
+    CountFail();
+    return false;
+  }
+  bbox = ClampRect(ToFrame(track_box.rect), img);
+  UpdateBox(img, bbox);
+  if (is_searching_) {
+    INFO("Auto track found the target again after %d frames. ", fail_count_);
+    is_searching_ = false;
+  }
+  fail_count_ = 0;
+  return true;
+}
+
+void AutoTrack::CountFail()
+{
+  fail_count_++;
+  if (fail_count_ == kSearchAfterFails) {
+    WARN("Auto track misses the target, search for it. ");
+    is_searching_ = true;
+    search_count_ = 0;
+    velocity_ = cv::Point2f(0.f, 0.f);
+    if (!last_img_.empty() && !MoveWindow(last_img_)) {
+      WARN("Widen auto track window fail. ");
     }
+  }
+  if (fail_count_ > loss_th_) {
+    WARN("Object lost, please set tracker to restart. ");
+    is_init_ = false;
+    is_lost_ = true;
+    is_searching_ = false;
+  }
+}
+
+bool AutoTrack::Reacquire(
+  const cv::Mat & img, const std::vector<InferBbox> & bodies,
+  cv::Rect & bbox)
+{
+  if (++search_count_ % kSearchInterval != 0 || bodies.empty() || target_hist_.empty()) {
+    CountFail();
     return false;
   }
-  bbox = track_box.rect & cv::Rect(0, 0, img.cols, img.rows);
+
+  int best = -1;
+  double best_sim = 0.;
+  double second_sim = 0.;
+  float last_height = std::max(last_box_.height, 1);
+  cv::Mat hist;
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    float ratio = bodies[i].body_box.height / last_height;
+    if (ratio > kReacquireScale || ratio * kReacquireScale < 1.f) {
+      continue;
+    }
+    BoxHist(img, bodies[i].body_box, hist);
+    if (hist.empty()) {
+      continue;
+    }
+    double sim = cv::compareHist(target_hist_, hist, cv::HISTCMP_CORREL);
+    if (sim > best_sim) {
+      second_sim = best_sim;
+      best_sim = sim;
+      best = i;
+    } else if (sim > second_sim) {
+      second_sim = sim;
+    }
+  }
+
+  // Colors are shared by many, the detection also has to stand out from the
+  // others or be near where the target was lost
+  bool is_near = false;
+  if (best >= 0) {
+    const cv::Rect & box = bodies[best].body_box;
+    float dx = box.x + box.width / 2.f - last_box_.x - last_box_.width / 2.f;
+    float dy = box.y + box.height / 2.f - last_box_.y - last_box_.height / 2.f;
+    float reach = last_height * (kReacquireReach + kReacquireSpread * fail_count_);
+    is_near = dx * dx + dy * dy <= reach * reach;
+  }
+  if (best < 0 || best_sim < kReacquireSim ||
+    (best_sim - second_sim < kReacquireMargin && !is_near))
+  {
+    INFO("Auto track search, best sim: %f, second sim: %f", best_sim, second_sim);
+    CountFail();
+    return false;
+  }
+
+  cv::Rect body = ClampRect(bodies[best].body_box, img);
+  is_searching_ = false;
+  if (!InitTracker(img, body)) {
+    is_searching_ = true;
+    CountFail();
+    return false;
+  }
+  INFO("Auto track found the target again after %d frames, sim: %f", fail_count_, best_sim);
+  bbox = body;
   fail_count_ = 0;
   return true;
 }
 
+bool AutoTrack::Track(
+  const cv::Mat & img, const std::vector<InferBbox> & bodies,
+  cv::Rect & bbox)
+{
+  if (img.empty()) {
+    WARN("Image empty cannot track.");
+    return false;
+  }
+
+  if (!is_init_) {
+    WARN("Please set tracker before auto track. ");
+    return false;
+  }
+
+  if (is_searching_) {
+    return Reacquire(img, bodies, bbox);
+  }
+
+  float iou = 0.f;
+  int index = MatchBody(last_box_, bodies, iou);
+  if (index >= 0) {
+    bbox = ClampRect(bodies[index].body_box, img);
+    INFO("Auto track takes detection %d, iou: %f", index, iou);
+    UpdateBox(img, bbox);
+    UpdateHist(img, bbox);
+    is_stale_ = true;
+    fail_count_ = 0;
+    return true;
+  }
+
+  // Restart the siamese search where the detections left the target
+  if (is_stale_ && !InitTracker(last_img_, last_box_)) {
+    WARN("Restart auto track from detection fail. ");
+  }
+  if (!Track(img, bbox)) {
+    return false;
+  }
+
+  // Pull a drifting siamese box back onto its detection
+  index = MatchBody(bbox, bodies, iou);
+  if (index >= 0) {
+    cv::Rect body = ClampRect(bodies[index].body_box, img);
+    if (iou < kReinitIoU && !InitTracker(img, body)) {
+      WARN("Restart auto track from detection fail. ");
+    }
+    UpdateHist(img, body);
+    bbox = body;
+    last_box_ = bbox;
+  }
+  return true;
+}
+
+int AutoTrack::MatchBody(
+  const cv::Rect & box, const std::vector<InferBbox> & bodies,
+  float & iou)
+{
+  int best = -1;
+  float best_iou = 0.f;
+  float second_iou = 0.f;
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    float value = RectIoU(box, bodies[i].body_box);
+    if (value > best_iou) {
+      second_iou = best_iou;
+      best_iou = value;
+      best = i;
+    } else if (value > second_iou) {
+      second_iou = value;
+    }
+  }
+  iou = best_iou;
+  if (best_iou < kSnapIoU || second_iou >= kAmbiguousIoU) {
+    return -1;
+  }
+  return best;
+}
+
 void AutoTrack::SetLossTh(int loss_th)
 {
   loss_th_ = loss_th;
@@ -93,6 +493,13 @@ void AutoTrack::SetLossTh(int loss_th)
 void AutoTrack::ResetTracker()
 {
   is_init_ = false;
+  is_searching_ = false;
+  last_img_.release();
+  target_hist_.release();
+  template_img_.release();
+  window_img_.release();
+  window_ = cv::Rect();
+  velocity_ = cv::Point2f(0.f, 0.f);
 }
 
 bool AutoTrack::GetLostStatus()
@@ -0,0 +1,99 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+
+#include "cyberdog_vision/detection_history.hpp"
+
+namespace cyberdog_vision
+{
+
+DetectionHistory::DetectionHistory()
+: head_(0), count_(0)
+{}
+
+void DetectionHistory::SetCapacity(size_t capacity)
+{
+  slots_.assign(capacity, DetectionFrame());
+  stamp_index_.clear();
+  stamp_index_.reserve(capacity);
+  head_ = 0;
+  count_ = 0;
+}
+
+void DetectionHistory::Push(const StampedImage & img, const BodyFrameInfo & infos)
+{
+  if (slots_.empty()) {
+    return;
+  }
+
+  // Overwrite the oldest slot and drop its stamp from the index
+  DetectionFrame & slot = slots_[head_];
+  if (count_ == slots_.size()) {
+    auto it = stamp_index_.find(slot.stamp_ns);
+    if (it != stamp_index_.end() && it->second == head_) {
+      stamp_index_.erase(it);
+    }
+  } else {
+    count_++;
+  }
+
+  slot.stamp_ns = StampToNs(img.header.stamp);
+  slot.frame = img;
+  slot.infos = infos;
+  stamp_index_[slot.stamp_ns] = head_;
+  head_ = (head_ + 1) % slots_.size();
+}
+
+void DetectionHistory::Clear()
+{
+  for (auto & slot : slots_) {
+    slot = DetectionFrame();
+  }
+  stamp_index_.clear();
+  head_ = 0;
+  count_ = 0;
+}
+
+bool DetectionHistory::Empty() const
+{
+  return count_ == 0;
+}
+
+size_t DetectionHistory::Size() const
+{
+  return count_;
+}
+
+const DetectionFrame & DetectionHistory::At(size_t index) const
+{
+  return slots_[(head_ + slots_.size() - 1 - index) % slots_.size()];
+}
+
+const DetectionFrame & DetectionHistory::Latest() const
+{
+  return At(0);
+}
+
+const DetectionFrame * DetectionHistory::FindByStamp(
+  const builtin_interfaces::msg::Time & stamp) const
+{
+  auto it = stamp_index_.find(StampToNs(stamp));
+  if (it == stamp_index_.end()) {
+    return nullptr;
+  }
+  return &slots_[it->second];
+}
+
+}  // namespace cyberdog_vision
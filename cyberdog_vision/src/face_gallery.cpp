@@ -0,0 +1,523 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <math.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "cyberdog_vision/face_gallery.hpp"
+
+namespace cyberdog_vision
+{
+
+// Candidates refined against their templates after the aggregate pass
+const size_t kRefineNum = 8;
+// Clusters probed per query, about a quarter of the lists
+const size_t kIndexMinProbe = 4;
+const size_t kIndexMaxProbe = 32;
+
+FaceGallery::FaceGallery()
+: dim_(0), stride_(0), precision_(kFeatFp32)
+{}
+
+int FaceGallery::Add(const std::string & name, const std::vector<float> & feat, bool is_host)
+{
+  std::vector<std::vector<float>> templates(1, feat);
+  std::vector<float> weights(1, 1.f);
+  return Add(name, templates, weights, is_host);
+}
+
+int FaceGallery::Add(
+  const std::string & name, const std::vector<std::vector<float>> & templates,
+  const std::vector<float> & weights, bool is_host)
+{
+  if (templates.empty() || templates.size() != weights.size()) {
+    return -1;
+  }
+  size_t dim = dim_ == 0 ? templates[0].size() : dim_;
+  for (auto & feat : templates) {
+    if (feat.empty() || feat.size() != dim) {
+      return -1;
+    }
+  }
+  if (dim_ == 0) {
+    dim_ = dim;
+    stride_ = AlignedStride(dim_);
+    feats_.Reset(precision_, stride_);
+    templates_.Reset(precision_, stride_);
+  }
+
+  size_t row;
+  auto it = index_.find(name);
+  if (it != index_.end()) {
+    row = it->second;
+    hosts_[row] = is_host;
+  } else {
+    row = names_.size();
+    names_.push_back(name);
+    hosts_.push_back(is_host);
+    template_nums_.push_back(0);
+    feats_.Resize(names_.size());
+    templates_.Resize(names_.size() * kMaxFaceTemplates);
+    weights_.resize(weights_.size() + kMaxFaceTemplates, 0.f);
+    index_[name] = row;
+  }
+
+  // Keep the best weighted templates when more are offered than fit
+  std::vector<size_t> order(templates.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(
+    order.begin(), order.end(), [&weights](size_t a, size_t b) {
+      return weights[a] > weights[b];
+    });
+  size_t num = std::min(order.size(), kMaxFaceTemplates);
+
+  // Build in float, the rows quantize on store
+  AlignedFloats agg(stride_, 0.f);
+  AlignedFloats tmpl(kMaxFaceTemplates * stride_, 0.f);
+  float * wts = &weights_[row * kMaxFaceTemplates];
+  memset(wts, 0, sizeof(float) * kMaxFaceTemplates);
+  for (size_t i = 0; i < num; ++i) {
+    float * dst = &tmpl[i * stride_];
+    memcpy(dst, templates[order[i]].data(), sizeof(float) * dim_);
+    L2Normalize(dst, dim_);
+    wts[i] = std::max(weights[order[i]], 0.f);
+    for (size_t d = 0; d < dim_; ++d) {
+      agg[d] += wts[i] * dst[d];
+    }
+  }
+  // All zero weights fall back to the plain mean
+  if (!L2Normalize(agg.data(), dim_)) {
+    for (size_t i = 0; i < num; ++i) {
+      wts[i] = 1.f;
+      for (size_t d = 0; d < dim_; ++d) {
+        agg[d] += tmpl[i * stride_ + d];
+      }
+    }
+    L2Normalize(agg.data(), dim_);
+  }
+  feats_.Set(row, agg.data());
+  for (size_t i = 0; i < kMaxFaceTemplates; ++i) {
+    templates_.Set(row * kMaxFaceTemplates + i, &tmpl[i * stride_]);
+  }
+  template_nums_[row] = num;
+  UpdateIndex(row);
+  return 0;
+}
+
+void FaceGallery::UpdateIndex(size_t row)
+{
+  // New rows join the trained lists, retraining is left to the owner
+  if (ivf_.Empty()) {
+    return;
+  }
+  if (names_.size() < kFaceIndexMinSize / 2) {
+    ivf_.Clear();
+    return;
+  }
+  AlignedFloats feat(stride_);
+  feats_.Get(row, feat.data());
+  ivf_.Insert(row, feat.data());
+}
+
+void FaceGallery::BuildIndex()
+{
+  if (names_.size() < kFaceIndexMinSize) {
+    ivf_.Clear();
+    return;
+  }
+  size_t nlist = static_cast<size_t>(sqrtf(static_cast<float>(names_.size())));
+  if (feats_.Data() != nullptr) {
+    ivf_.Train(feats_.Data(), names_.size(), dim_, nlist);
+    return;
+  }
+  AlignedFloats rows(names_.size() * stride_);
+  for (size_t row = 0; row < names_.size(); ++row) {
+    feats_.Get(row, &rows[row * stride_]);
+  }
+  ivf_.Train(rows.data(), names_.size(), dim_, nlist);
+}
+
+bool FaceGallery::NeedIndex() const
+{
+  // Retrain once the gallery doubled since the last training
+  return names_.size() >= kFaceIndexMinSize &&
+    (ivf_.Empty() || names_.size() >= 2 * ivf_.TrainedSize());
+}
+
+int FaceGallery::SetIndex(const FaceIndex & index)
+{
+  if (index.Empty() || index.Size() != names_.size() || index.TrainedSize() != names_.size()) {
+    return -1;
+  }
+  ivf_ = index;
+  return 0;
+}
+
+const FaceIndex & FaceGallery::Index() const
+{
+  return ivf_;
+}
+
+int FaceGallery::Assign(
+  size_t dim, const float * rows, const float * templates, const float * weights,
+  const std::vector<uint8_t> & template_nums, const std::vector<std::string> & names,
+  const std::vector<uint8_t> & hosts)
+{
+  if (names.size() != hosts.size() || names.size() != template_nums.size() ||
+    (dim == 0 && !names.empty()))
+  {
+    return -1;
+  }
+  for (auto num : template_nums) {
+    if (num == 0 || num > kMaxFaceTemplates) {
+      return -1;
+    }
+  }
+
+  Clear();
+  if (names.empty()) {
+    return 0;
+  }
+  dim_ = dim;
+  stride_ = AlignedStride(dim_);
+  feats_.Reset(precision_, stride_);
+  feats_.Assign(rows, names.size());
+  templates_.Reset(precision_, stride_);
+  templates_.Assign(templates, names.size() * kMaxFaceTemplates);
+  weights_.assign(weights, weights + names.size() * kMaxFaceTemplates);
+  template_nums_ = template_nums;
+  names_ = names;
+  hosts_ = hosts;
+  index_.reserve(names_.size());
+  for (size_t row = 0; row < names_.size(); ++row) {
+    index_[names_[row]] = row;
+  }
+  return 0;
+}
+
+void FaceGallery::MoveRow(size_t from, size_t to)
+{
+  feats_.Move(from, to);
+  for (size_t i = 0; i < kMaxFaceTemplates; ++i) {
+    templates_.Move(from * kMaxFaceTemplates + i, to * kMaxFaceTemplates + i);
+  }
+  memcpy(
+    &weights_[to * kMaxFaceTemplates], &weights_[from * kMaxFaceTemplates],
+    sizeof(float) * kMaxFaceTemplates);
+  template_nums_[to] = template_nums_[from];
+  names_[to] = names_[from];
+  hosts_[to] = hosts_[from];
+  index_[names_[to]] = to;
+}
+
+int FaceGallery::Remove(const std::string & name)
+{
+  auto it = index_.find(name);
+  if (it == index_.end()) {
+    return -1;
+  }
+
+  // Move the last row into the hole to keep the matrices dense
+  size_t row = it->second;
+  size_t last = names_.size() - 1;
+  index_.erase(it);
+  if (row != last) {
+    MoveRow(last, row);
+  }
+  ivf_.Remove(row);
+  if (last < kFaceIndexMinSize / 2) {
+    ivf_.Clear();
+  }
+  names_.pop_back();
+  hosts_.pop_back();
+  template_nums_.pop_back();
+  feats_.Resize(last);
+  templates_.Resize(last * kMaxFaceTemplates);
+  weights_.resize(last * kMaxFaceTemplates);
+  return 0;
+}
+
+int FaceGallery::Rename(const std::string & ori_name, const std::string & new_name)
+{
+  if (index_.find(ori_name) == index_.end()) {
+    return -1;
+  }
+  if (ori_name == new_name) {
+    return 0;
+  }
+
+  // Renaming onto an existing identity replaces it
+  Remove(new_name);
+  auto it = index_.find(ori_name);
+  size_t row = it->second;
+  index_.erase(it);
+  names_[row] = new_name;
+  index_[new_name] = row;
+  return 0;
+}
+
+void FaceGallery::Clear()
+{
+  dim_ = 0;
+  stride_ = 0;
+  feats_.Reset(precision_, 0);
+  templates_.Reset(precision_, 0);
+  weights_.clear();
+  template_nums_.clear();
+  names_.clear();
+  hosts_.clear();
+  index_.clear();
+  ivf_.Clear();
+}
+
+void FaceGallery::SetPrecision(FeatPrecision precision)
+{
+  precision_ = precision;
+  feats_.Convert(precision_);
+  templates_.Convert(precision_);
+}
+
+bool FaceGallery::Find(const std::string & name) const
+{
+  return index_.find(name) != index_.end();
+}
+
+bool FaceGallery::GetIndex(const std::string & name, size_t & index) const
+{
+  auto it = index_.find(name);
+  if (it == index_.end()) {
+    return false;
+  }
+  index = it->second;
+  return true;
+}
+
+bool FaceGallery::Empty() const
+{
+  return names_.empty();
+}
+
+size_t FaceGallery::Size() const
+{
+  return names_.size();
+}
+
+size_t FaceGallery::Dim() const
+{
+  return dim_;
+}
+
+size_t FaceGallery::Stride() const
+{
+  return stride_;
+}
+
+FeatPrecision FaceGallery::Precision() const
+{
+  return precision_;
+}
+
+size_t FaceGallery::Bytes() const
+{
+  return feats_.Bytes() + templates_.Bytes() + weights_.size() * sizeof(float);
+}
+
+const float * FaceGallery::WeightData() const
+{
+  return weights_.data();
+}
+
+const std::string & FaceGallery::Name(size_t index) const
+{
+  return names_[index];
+}
+
+bool FaceGallery::IsHost(size_t index) const
+{
+  return hosts_[index] != 0;
+}
+
+void FaceGallery::GetFeature(size_t index, float * feat) const
+{
+  feats_.Get(index, feat);
+}
+
+size_t FaceGallery::TemplateNum(size_t index) const
+{
+  return template_nums_[index];
+}
+
+void FaceGallery::GetTemplate(size_t index, size_t slot, float * feat) const
+{
+  templates_.Get(index * kMaxFaceTemplates + slot, feat);
+}
+
+float FaceGallery::Weight(size_t index, size_t slot) const
+{
+  return weights_[index * kMaxFaceTemplates + slot];
+}
+
+bool FaceGallery::Normalize(const std::vector<float> & feat, AlignedFloats & query) const
+{
+  if (names_.empty() || feat.size() != dim_) {
+    return false;
+  }
+  query.assign(stride_, 0.f);
+  memcpy(query.data(), feat.data(), sizeof(float) * dim_);
+  return L2Normalize(query.data(), dim_);
+}
+
+void FaceGallery::TopK(
+  const float * query, float query_sum, const std::vector<uint32_t> * rows, size_t k,
+  std::vector<GalleryMatch> & matches) const
+{
+  // Keep the best k in a small sorted buffer
+  size_t count = rows != nullptr ? rows->size() : names_.size();
+  k = std::min(k, count);
+  matches.clear();
+  matches.reserve(k + 1);
+  auto greater = [](const GalleryMatch & a, const GalleryMatch & b) {
+      return a.score > b.score;
+    };
+  for (size_t i = 0; i < count; ++i) {
+    size_t row = rows != nullptr ? (*rows)[i] : i;
+    float score = feats_.Dot(query, query_sum, row);
+    if (matches.size() == k && score <= matches.back().score) {
+      continue;
+    }
+    GalleryMatch match;
+    match.index = row;
+    match.score = score;
+    matches.insert(std::upper_bound(matches.begin(), matches.end(), match, greater), match);
+    if (matches.size() > k) {
+      matches.pop_back();
+    }
+  }
+}
+
+float FaceGallery::Refine(const float * query, float query_sum, size_t index) const
+{
+  float best = -1.f;
+  for (size_t i = 0; i < template_nums_[index]; ++i) {
+    best = std::max(best, templates_.Dot(query, query_sum, index * kMaxFaceTemplates + i));
+  }
+  return best;
+}
+
+void FaceGallery::RefineTopK(
+  const float * query, float query_sum, size_t k,
+  std::vector<GalleryMatch> & matches) const
+{
+  // The aggregate pass shortlists candidates, the score reported is the
+  // best single template of each candidate.
+  for (auto & match : matches) {
+    match.score = Refine(query, query_sum, match.index);
+  }
+  std::stable_sort(
+    matches.begin(), matches.end(), [](const GalleryMatch & a, const GalleryMatch & b) {
+      return a.score > b.score;
+    });
+  if (matches.size() > k) {
+    matches.resize(k);
+  }
+}
+
+void FaceGallery::Query(
+  const std::vector<float> & feat, size_t k,
+  std::vector<GalleryMatch> & matches) const
+{
+  matches.clear();
+  AlignedFloats query;
+  if (k == 0 || !Normalize(feat, query)) {
+    return;
+  }
+
+  float query_sum = precision_ == kFeatInt8 ? Sum(query.data(), stride_) : 0.f;
+  if (ivf_.Empty()) {
+    TopK(query.data(), query_sum, nullptr, std::max(k, kRefineNum), matches);
+  } else {
+    std::vector<uint32_t> rows;
+    size_t nprobe = std::min(std::max(ivf_.Nlist() / 4, kIndexMinProbe), kIndexMaxProbe);
+    ivf_.Search(query.data(), nprobe, rows);
+    TopK(query.data(), query_sum, &rows, std::max(k, kRefineNum), matches);
+  }
+  RefineTopK(query.data(), query_sum, k, matches);
+}
+
+void FaceGallery::QueryExact(
+  const std::vector<float> & feat, size_t k,
+  std::vector<GalleryMatch> & matches) const
+{
+  matches.clear();
+  AlignedFloats query;
+  if (k == 0 || !Normalize(feat, query)) {
+    return;
+  }
+  float query_sum = precision_ == kFeatInt8 ? Sum(query.data(), stride_) : 0.f;
+  TopK(query.data(), query_sum, nullptr, std::max(k, kRefineNum), matches);
+  RefineTopK(query.data(), query_sum, k, matches);
+}
+
+void MeasureQuantError(
+  const FaceGallery & reference, const FaceGallery & quantized,
+  size_t max_probes, QuantReport & report)
+{
+  report = QuantReport();
+  if (reference.Size() != quantized.Size() || reference.Dim() != quantized.Dim() ||
+    reference.Empty() || max_probes == 0)
+  {
+    return;
+  }
+
+  // Spread the probes over the gallery, each probe is a stored template
+  // so the best match is a near duplicate and the second an impostor.
+  size_t step = std::max(reference.Size() / max_probes, static_cast<size_t>(1));
+  size_t agree = 0;
+  size_t deltas = 0;
+  float sum_delta = 0.f;
+  AlignedFloats probe(reference.Stride());
+  std::vector<GalleryMatch> ref_matches;
+  std::vector<GalleryMatch> quant_matches;
+  for (size_t row = 0; row < reference.Size() && report.probes < max_probes; row += step) {
+    reference.GetTemplate(row, 0, probe.data());
+    std::vector<float> feat(probe.begin(), probe.begin() + reference.Dim());
+    reference.QueryExact(feat, 2, ref_matches);
+    quantized.QueryExact(feat, 2, quant_matches);
+    if (ref_matches.empty() || ref_matches.size() != quant_matches.size()) {
+      continue;
+    }
+    for (size_t i = 0; i < ref_matches.size(); ++i) {
+      float delta = fabsf(ref_matches[i].score - quant_matches[i].score);
+      sum_delta += delta;
+      deltas++;
+      report.max_delta = std::max(report.max_delta, delta);
+    }
+    if (ref_matches[0].index == quant_matches[0].index) {
+      agree++;
+    }
+    report.probes++;
+  }
+  if (report.probes > 0) {
+    report.mean_delta = sum_delta / deltas;
+    report.top1_agree = static_cast<float>(agree) / report.probes;
+  }
+}
+
+}  // namespace cyberdog_vision
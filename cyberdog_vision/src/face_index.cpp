@@ -0,0 +1,240 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "cyberdog_vision/face_index.hpp"
+
+namespace cyberdog_vision
+{
+
+const int kKMeansIters = 8;
+
+FaceIndex::FaceIndex()
+: dim_(0), stride_(0), nlist_(0), trained_size_(0)
+{}
+
+void FaceIndex::Clear()
+{
+  dim_ = 0;
+  stride_ = 0;
+  nlist_ = 0;
+  trained_size_ = 0;
+  centroids_.clear();
+  lists_.clear();
+  row_list_.clear();
+  row_pos_.clear();
+}
+
+bool FaceIndex::Empty() const
+{
+  return nlist_ == 0;
+}
+
+void FaceIndex::Train(const float * rows, size_t count, size_t dim, size_t nlist)
+{
+  Clear();
+  if (count == 0 || dim == 0 || nlist == 0) {
+    return;
+  }
+  dim_ = dim;
+  stride_ = AlignedStride(dim);
+  nlist_ = std::min(nlist, count);
+  trained_size_ = count;
+
+  // Seed with evenly spaced rows, deterministic across restarts
+  centroids_.assign(nlist_ * stride_, 0.f);
+  for (size_t c = 0; c < nlist_; ++c) {
+    memcpy(
+      &centroids_[c * stride_], rows + (c * count / nlist_) * stride_,
+      sizeof(float) * stride_);
+  }
+
+  std::vector<uint32_t> assign(count, 0);
+  std::vector<float> sums(nlist_ * stride_);
+  std::vector<size_t> sizes(nlist_);
+  for (int iter = 0; iter < kKMeansIters; ++iter) {
+    for (size_t row = 0; row < count; ++row) {
+      assign[row] = Nearest(rows + row * stride_);
+    }
+    std::fill(sums.begin(), sums.end(), 0.f);
+    std::fill(sizes.begin(), sizes.end(), 0);
+    for (size_t row = 0; row < count; ++row) {
+      float * sum = &sums[assign[row] * stride_];
+      const float * feat = rows + row * stride_;
+      for (size_t d = 0; d < dim_; ++d) {
+        sum[d] += feat[d];
+      }
+      sizes[assign[row]]++;
+    }
+    // Empty clusters keep their previous centroid
+    for (size_t c = 0; c < nlist_; ++c) {
+      if (sizes[c] > 0 && L2Normalize(&sums[c * stride_], dim_)) {
+        memcpy(&centroids_[c * stride_], &sums[c * stride_], sizeof(float) * stride_);
+      }
+    }
+  }
+
+  lists_.assign(nlist_, std::vector<uint32_t>());
+  for (size_t row = 0; row < count; ++row) {
+    Insert(row, rows + row * stride_);
+  }
+}
+
+int FaceIndex::Assign(
+  size_t dim, size_t nlist, const float * centroids,
+  const std::vector<uint32_t> & row_lists)
+{
+  Clear();
+  if (dim == 0 || nlist == 0) {
+    return -1;
+  }
+  for (auto list : row_lists) {
+    if (list >= nlist) {
+      return -1;
+    }
+  }
+  dim_ = dim;
+  stride_ = AlignedStride(dim);
+  nlist_ = nlist;
+  trained_size_ = row_lists.size();
+  centroids_.assign(centroids, centroids + nlist_ * stride_);
+  lists_.assign(nlist_, std::vector<uint32_t>());
+  for (size_t row = 0; row < row_lists.size(); ++row) {
+    row_list_.push_back(0);
+    row_pos_.push_back(0);
+    Link(row, row_lists[row]);
+  }
+  return 0;
+}
+
+void FaceIndex::Insert(size_t row, const float * feat)
+{
+  if (Empty() || row > row_list_.size()) {
+    return;
+  }
+  if (row == row_list_.size()) {
+    row_list_.push_back(0);
+    row_pos_.push_back(0);
+  } else {
+    Unlink(row);
+  }
+  Link(row, Nearest(feat));
+}
+
+void FaceIndex::Remove(size_t row)
+{
+  if (Empty() || row >= row_list_.size()) {
+    return;
+  }
+
+  // Mirror the gallery, the last row takes the removed row number
+  size_t last = row_list_.size() - 1;
+  Unlink(row);
+  if (row != last) {
+    size_t list = row_list_[last];
+    size_t pos = row_pos_[last];
+    lists_[list][pos] = row;
+    row_list_[row] = list;
+    row_pos_[row] = pos;
+  }
+  row_list_.pop_back();
+  row_pos_.pop_back();
+}
+
+void FaceIndex::Search(
+  const float * query, size_t nprobe,
+  std::vector<uint32_t> & rows) const
+{
+  rows.clear();
+  if (Empty()) {
+    return;
+  }
+
+  std::vector<std::pair<float, size_t>> scores(nlist_);
+  for (size_t c = 0; c < nlist_; ++c) {
+    scores[c] = std::make_pair(Dot(query, &centroids_[c * stride_], stride_), c);
+  }
+  nprobe = std::min(nprobe, nlist_);
+  std::partial_sort(
+    scores.begin(), scores.begin() + nprobe, scores.end(),
+    [](const std::pair<float, size_t> & a, const std::pair<float, size_t> & b) {
+      return a.first > b.first;
+    });
+  for (size_t i = 0; i < nprobe; ++i) {
+    const std::vector<uint32_t> & list = lists_[scores[i].second];
+    rows.insert(rows.end(), list.begin(), list.end());
+  }
+}
+
+size_t FaceIndex::Nlist() const
+{
+  return nlist_;
+}
+
+size_t FaceIndex::Size() const
+{
+  return row_list_.size();
+}
+
+size_t FaceIndex::TrainedSize() const
+{
+  return trained_size_;
+}
+
+const float * FaceIndex::Centroids() const
+{
+  return centroids_.data();
+}
+
+const std::vector<uint32_t> & FaceIndex::RowLists() const
+{
+  return row_list_;
+}
+
+size_t FaceIndex::Nearest(const float * feat) const
+{
+  size_t best = 0;
+  float best_score = -2.f;
+  for (size_t c = 0; c < nlist_; ++c) {
+    float score = Dot(feat, &centroids_[c * stride_], stride_);
+    if (score > best_score) {
+      best = c;
+      best_score = score;
+    }
+  }
+  return best;
+}
+
+void FaceIndex::Unlink(size_t row)
+{
+  std::vector<uint32_t> & list = lists_[row_list_[row]];
+  size_t pos = row_pos_[row];
+  list[pos] = list.back();
+  row_pos_[list[pos]] = pos;
+  list.pop_back();
+}
+
+void FaceIndex::Link(size_t row, size_t list)
+{
+  row_list_[row] = list;
+  row_pos_[row] = lists_[list].size();
+  lists_[list].push_back(row);
+}
+
+}  // namespace cyberdog_vision
@@ -0,0 +1,554 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "cyberdog_vision/face_library_file.hpp"
+#include "cyberdog_common/cyberdog_log.hpp"
+
+namespace cyberdog_vision
+{
+
+static const char kFaceLibraryMagic[4] = {'X', 'M', 'F', 'L'};
+static const uint32_t kFaceJournalMagic = 0x4A464D58;  // "XMFJ"
+static const char kFaceIndexMagic[4] = {'X', 'M', 'F', 'I'};
+
+struct Crc32Table
+{
+  uint32_t value[256];
+  Crc32Table()
+  {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+      }
+      value[i] = c;
+    }
+  }
+};
+
+uint32_t Crc32(const void * data, size_t len, uint32_t crc)
+{
+  static const Crc32Table table;
+  const uint8_t * bytes = reinterpret_cast<const uint8_t *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < len; ++i) {
+    crc = table.value[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+int SyncParentDir(const std::string & path)
+{
+  size_t pos = path.rfind('/');
+  std::string dir = pos == std::string::npos ? "." : path.substr(0, pos + 1);
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    WARN("Open directory %s to sync fail. ", dir.c_str());
+    return -1;
+  }
+  int ret = fsync(fd);
+  close(fd);
+  if (0 != ret) {
+    WARN("Sync directory %s fail. ", dir.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+int WriteFileAtomic(const std::string & path, const std::vector<uint8_t> & buf)
+{
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    WARN("Open %s to write fail. ", tmp_path.c_str());
+    return -1;
+  }
+  size_t written = 0;
+  while (written < buf.size()) {
+    ssize_t n = write(fd, buf.data() + written, buf.size() - written);
+    if (n <= 0) {
+      WARN("Write %s fail. ", tmp_path.c_str());
+      close(fd);
+      unlink(tmp_path.c_str());
+      return -1;
+    }
+    written += n;
+  }
+  if (0 != fsync(fd)) {
+    WARN("Sync %s fail. ", tmp_path.c_str());
+    close(fd);
+    unlink(tmp_path.c_str());
+    return -1;
+  }
+  close(fd);
+  if (0 != rename(tmp_path.c_str(), path.c_str())) {
+    WARN("Rename to %s fail. ", path.c_str());
+    unlink(tmp_path.c_str());
+    return -1;
+  }
+  return SyncParentDir(path);
+}
+
+int ReadFaceLibraryYaml(const std::string & path, FaceGallery & gallery)
+{
+  cv::FileStorage fs(path, cv::FileStorage::READ);
+  if (!fs.isOpened()) {
+    WARN("Open the face library yaml %s fail. ", path.c_str());
+    return -1;
+  }
+
+  gallery.Clear();
+  cv::FileNode node = fs["UserFaceInfo"];
+  for (cv::FileNodeIterator it = node.begin(); it != node.end(); ++it) {
+    std::string name;
+    int is_host = 0;
+    std::vector<float> feat;
+    (*it)["name"] >> name;
+    (*it)["is_host"] >> is_host;
+    (*it)["feature"] >> feat;
+    if (0 != gallery.Add(name, feat, is_host)) {
+      WARN("Skip invalid face feature of %s. ", name.c_str());
+    }
+  }
+  fs.release();
+  return 0;
+}
+
+int ReadFaceLibraryBin(const std::string & path, FaceGallery & gallery, uint32_t & journal_seq)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (0 != fstat(fd, &st) || st.st_size < static_cast<off_t>(sizeof(FaceLibraryHeader))) {
+    WARN("Face library %s is truncated. ", path.c_str());
+    close(fd);
+    return -1;
+  }
+  size_t size = st.st_size;
+  void * addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    WARN("Map face library %s fail. ", path.c_str());
+    return -1;
+  }
+
+  int ret = -1;
+  const uint8_t * base = reinterpret_cast<const uint8_t *>(addr);
+  const uint8_t * end = base + size;
+  FaceLibraryHeader header;
+  memcpy(&header, base, sizeof(header));
+  bool has_templates = header.version >= 2;
+  size_t slots = has_templates ? kMaxFaceTemplates : 0;
+  size_t feats_size = static_cast<size_t>(header.count) * header.stride * sizeof(float);
+  size_t tmpl_size = feats_size * slots;
+  size_t weights_size = static_cast<size_t>(header.count) * slots * sizeof(float);
+  const uint8_t * payload = base + sizeof(header);
+  const uint8_t * names = payload + feats_size + tmpl_size + weights_size;
+  if (0 != memcmp(header.magic, kFaceLibraryMagic, sizeof(kFaceLibraryMagic)) ||
+    header.version == 0 || header.version > kFaceLibraryVersion)
+  {
+    WARN("Face library %s has unknown format. ", path.c_str());
+  } else if (header.stride != AlignedStride(header.dim) ||
+    sizeof(header) + feats_size + tmpl_size + weights_size + header.names_size != size)
+  {
+    WARN("Face library %s size mismatch. ", path.c_str());
+  } else if (Crc32(payload, size - sizeof(header)) != header.checksum) {
+    WARN("Face library %s checksum mismatch. ", path.c_str());
+  } else {
+    std::vector<std::string> name_list(header.count);
+    std::vector<uint8_t> host_list(header.count, 0);
+    std::vector<uint8_t> num_list(header.count, 1);
+    size_t entry_size = sizeof(uint32_t) + (has_templates ? 2 : 1);
+    const uint8_t * ptr = names;
+    bool is_valid = true;
+    for (uint32_t i = 0; i < header.count; ++i) {
+      uint32_t len = 0;
+      if (ptr + entry_size > end) {
+        is_valid = false;
+        break;
+      }
+      memcpy(&len, ptr, sizeof(len));
+      host_list[i] = ptr[sizeof(len)];
+      if (has_templates) {
+        num_list[i] = ptr[sizeof(len) + 1];
+      }
+      ptr += entry_size;
+      if (ptr + len > end) {
+        is_valid = false;
+        break;
+      }
+      name_list[i].assign(reinterpret_cast<const char *>(ptr), len);
+      ptr += len;
+    }
+    if (!is_valid) {
+      WARN("Face library %s has broken name table. ", path.c_str());
+    } else if (has_templates) {
+      journal_seq = header.journal_seq;
+      const float * rows = reinterpret_cast<const float *>(payload);
+      const float * templates = reinterpret_cast<const float *>(payload + feats_size);
+      const float * weights =
+        reinterpret_cast<const float *>(payload + feats_size + tmpl_size);
+      ret = gallery.Assign(header.dim, rows, templates, weights, num_list, name_list, host_list);
+    } else {
+      // The single feature of a version 1 row becomes its only template
+      journal_seq = header.journal_seq;
+      const float * rows = reinterpret_cast<const float *>(payload);
+      gallery.Clear();
+      ret = 0;
+      for (uint32_t i = 0; i < header.count; ++i) {
+        std::vector<float> feat(rows + i * header.stride, rows + i * header.stride + header.dim);
+        if (0 != gallery.Add(name_list[i], feat, host_list[i])) {
+          ret = -1;
+          break;
+        }
+      }
+    }
+  }
+
+  munmap(addr, size);
+  return ret;
+}
+
+int WriteFaceLibraryBin(
+  const std::string & path, const FaceGallery & gallery,
+  uint32_t journal_seq)
+{
+  // Dequantized rows would replace the float library at a lower accuracy
+  if (gallery.Precision() != kFeatFp32) {
+    WARN("Refuse to save a %s face library. ", FeatPrecisionName(gallery.Precision()));
+    return -1;
+  }
+
+  FaceLibraryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kFaceLibraryMagic, sizeof(kFaceLibraryMagic));
+  header.version = kFaceLibraryVersion;
+  header.dim = gallery.Dim();
+  header.stride = gallery.Stride();
+  header.count = gallery.Size();
+  header.journal_seq = journal_seq;
+
+  size_t feats_size = gallery.Size() * gallery.Stride() * sizeof(float);
+  size_t tmpl_size = feats_size * kMaxFaceTemplates;
+  size_t weights_size = gallery.Size() * kMaxFaceTemplates * sizeof(float);
+  std::vector<uint8_t> buf(sizeof(header) + feats_size + tmpl_size + weights_size);
+  if (!gallery.Empty()) {
+    size_t row_size = gallery.Stride() * sizeof(float);
+    AlignedFloats row(gallery.Stride());
+    uint8_t * ptr = buf.data() + sizeof(header);
+    for (size_t i = 0; i < gallery.Size(); ++i) {
+      gallery.GetFeature(i, row.data());
+      memcpy(ptr + i * row_size, row.data(), row_size);
+      for (size_t slot = 0; slot < kMaxFaceTemplates; ++slot) {
+        gallery.GetTemplate(i, slot, row.data());
+        memcpy(ptr + feats_size + (i * kMaxFaceTemplates + slot) * row_size, row.data(), row_size);
+      }
+    }
+    memcpy(ptr + feats_size + tmpl_size, gallery.WeightData(), weights_size);
+  }
+  for (size_t i = 0; i < gallery.Size(); ++i) {
+    const std::string & name = gallery.Name(i);
+    uint32_t len = name.size();
+    const uint8_t * len_ptr = reinterpret_cast<const uint8_t *>(&len);
+    buf.insert(buf.end(), len_ptr, len_ptr + sizeof(len));
+    buf.push_back(gallery.IsHost(i));
+    buf.push_back(gallery.TemplateNum(i));
+    buf.insert(buf.end(), name.begin(), name.end());
+  }
+  header.names_size = buf.size() - sizeof(header) - feats_size - tmpl_size - weights_size;
+  header.checksum = Crc32(buf.data() + sizeof(header), buf.size() - sizeof(header));
+  memcpy(buf.data(), &header, sizeof(header));
+
+  return WriteFileAtomic(path, buf);
+}
+
+static uint32_t RowsChecksum(const FaceGallery & gallery)
+{
+  uint32_t crc = 0;
+  AlignedFloats row(gallery.Stride());
+  for (size_t i = 0; i < gallery.Size(); ++i) {
+    gallery.GetFeature(i, row.data());
+    crc = Crc32(row.data(), gallery.Stride() * sizeof(float), crc);
+  }
+  return crc;
+}
+
+int ReadFaceIndexBin(const std::string & path, FaceGallery & gallery)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  std::vector<uint8_t> buf;
+  uint8_t chunk[4096];
+  ssize_t n;
+  while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+  close(fd);
+
+  FaceIndexHeader header;
+  if (buf.size() < sizeof(header)) {
+    WARN("Face index %s is truncated. ", path.c_str());
+    return -1;
+  }
+  memcpy(&header, buf.data(), sizeof(header));
+  size_t stride = AlignedStride(header.dim);
+  size_t centroids_size = static_cast<size_t>(header.nlist) * stride * sizeof(float);
+  size_t lists_size = static_cast<size_t>(header.count) * sizeof(uint32_t);
+  if (0 != memcmp(header.magic, kFaceIndexMagic, sizeof(kFaceIndexMagic)) ||
+    header.version != kFaceIndexVersion ||
+    sizeof(header) + centroids_size + lists_size != buf.size() ||
+    Crc32(buf.data() + sizeof(header), buf.size() - sizeof(header)) != header.checksum)
+  {
+    WARN("Face index %s is broken. ", path.c_str());
+    return -1;
+  }
+  if (header.dim != gallery.Dim() || header.count != gallery.Size() ||
+    header.rows_checksum != RowsChecksum(gallery))
+  {
+    INFO("Face index %s is stale. ", path.c_str());
+    return -1;
+  }
+
+  // Copy out through aligned storage, the buffer gives no alignment
+  AlignedFloats centroids(header.nlist * stride);
+  memcpy(centroids.data(), buf.data() + sizeof(header), centroids_size);
+  std::vector<uint32_t> row_lists(header.count);
+  if (header.count > 0) {
+    memcpy(row_lists.data(), buf.data() + sizeof(header) + centroids_size, lists_size);
+  }
+  FaceIndex index;
+  if (0 != index.Assign(header.dim, header.nlist, centroids.data(), row_lists) ||
+    0 != gallery.SetIndex(index))
+  {
+    WARN("Face index %s does not fit the library. ", path.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+int WriteFaceIndexBin(const std::string & path, const FaceGallery & gallery)
+{
+  const FaceIndex & index = gallery.Index();
+  if (index.Empty()) {
+    unlink(path.c_str());
+    return 0;
+  }
+
+  FaceIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kFaceIndexMagic, sizeof(kFaceIndexMagic));
+  header.version = kFaceIndexVersion;
+  header.dim = gallery.Dim();
+  header.nlist = index.Nlist();
+  header.count = index.Size();
+  header.rows_checksum = RowsChecksum(gallery);
+
+  size_t centroids_size = index.Nlist() * gallery.Stride() * sizeof(float);
+  size_t lists_size = index.Size() * sizeof(uint32_t);
+  std::vector<uint8_t> buf(sizeof(header) + centroids_size + lists_size);
+  memcpy(buf.data() + sizeof(header), index.Centroids(), centroids_size);
+  if (lists_size > 0) {
+    memcpy(buf.data() + sizeof(header) + centroids_size, index.RowLists().data(), lists_size);
+  }
+  header.checksum = Crc32(buf.data() + sizeof(header), buf.size() - sizeof(header));
+  memcpy(buf.data(), &header, sizeof(header));
+  return WriteFileAtomic(path, buf);
+}
+
+void EncodeJournalRecord(const FaceJournalRecord & record, std::vector<uint8_t> & buf)
+{
+  FaceJournalHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kFaceJournalMagic;
+  header.seq = record.seq;
+  header.op = record.op;
+  header.is_host = record.is_host;
+  header.name_size = record.name.size();
+  header.new_name_size = record.new_name.size();
+  header.template_num = record.templates.size();
+  header.feat_len = record.weights.size();
+  for (auto & feat : record.templates) {
+    header.feat_len += feat.size();
+  }
+
+  buf.resize(
+    sizeof(header) + header.name_size + header.new_name_size +
+    header.feat_len * sizeof(float));
+  uint8_t * ptr = buf.data() + sizeof(header);
+  memcpy(ptr, record.name.data(), header.name_size);
+  ptr += header.name_size;
+  memcpy(ptr, record.new_name.data(), header.new_name_size);
+  ptr += header.new_name_size;
+  for (auto & feat : record.templates) {
+    memcpy(ptr, feat.data(), feat.size() * sizeof(float));
+    ptr += feat.size() * sizeof(float);
+  }
+  if (!record.weights.empty()) {
+    memcpy(ptr, record.weights.data(), record.weights.size() * sizeof(float));
+  }
+  memcpy(buf.data(), &header, sizeof(header));
+  header.checksum = Crc32(buf.data(), buf.size());
+  memcpy(buf.data(), &header, sizeof(header));
+}
+
+void ApplyJournalRecord(const FaceJournalRecord & record, FaceGallery & gallery)
+{
+  switch (record.op) {
+    case kJournalAdd:
+      if (0 != gallery.Add(record.name, record.templates, record.weights, record.is_host)) {
+        WARN("Skip invalid face journal record %u. ", record.seq);
+      }
+      break;
+    case kJournalRename:
+      gallery.Rename(record.name, record.new_name);
+      break;
+    case kJournalDelete:
+      gallery.Remove(record.name);
+      break;
+    default:
+      WARN("Unknown face journal op %d. ", record.op);
+      break;
+  }
+}
+
+int ReplayFaceJournal(
+  const std::string & path, FaceGallery & gallery, uint32_t & journal_seq,
+  size_t & valid_size, uint32_t max_seq)
+{
+  valid_size = 0;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  std::vector<uint8_t> buf;
+  uint8_t chunk[4096];
+  ssize_t n;
+  while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+  close(fd);
+
+  size_t offset = 0;
+  size_t applied = 0;
+  while (offset + sizeof(FaceJournalHeader) <= buf.size()) {
+    FaceJournalHeader header;
+    memcpy(&header, buf.data() + offset, sizeof(header));
+    size_t body_size = static_cast<size_t>(header.name_size) + header.new_name_size +
+      static_cast<size_t>(header.feat_len) * sizeof(float);
+    if (header.magic != kFaceJournalMagic ||
+      offset + sizeof(header) + body_size > buf.size())
+    {
+      break;
+    }
+    uint32_t checksum = header.checksum;
+    header.checksum = 0;
+    uint32_t crc = Crc32(&header, sizeof(header));
+    crc = Crc32(buf.data() + offset + sizeof(header), body_size, crc);
+    if (crc != checksum) {
+      break;
+    }
+
+    const uint8_t * ptr = buf.data() + offset + sizeof(header);
+    FaceJournalRecord record;
+    record.seq = header.seq;
+    record.op = header.op;
+    record.is_host = header.is_host;
+    record.name.assign(reinterpret_cast<const char *>(ptr), header.name_size);
+    ptr += header.name_size;
+    record.new_name.assign(reinterpret_cast<const char *>(ptr), header.new_name_size);
+    ptr += header.new_name_size;
+    std::vector<float> floats(header.feat_len);
+    if (header.feat_len > 0) {
+      memcpy(floats.data(), ptr, header.feat_len * sizeof(float));
+    }
+    if (header.template_num == 0) {
+      // Legacy record with one feature
+      if (!floats.empty()) {
+        record.templates.push_back(floats);
+        record.weights.push_back(1.f);
+      }
+    } else if (header.feat_len % header.template_num == 0) {
+      size_t dim = header.feat_len / header.template_num - 1;
+      for (size_t i = 0; i < header.template_num; ++i) {
+        record.templates.emplace_back(
+          floats.begin() + i * dim, floats.begin() + (i + 1) * dim);
+      }
+      record.weights.assign(floats.begin() + header.template_num * dim, floats.end());
+    }
+    if (record.seq > journal_seq && record.seq <= max_seq) {
+      ApplyJournalRecord(record, gallery);
+      journal_seq = record.seq;
+      applied++;
+    }
+    offset += sizeof(header) + body_size;
+  }
+  valid_size = offset;
+  if (offset != buf.size()) {
+    WARN("Drop %zu broken bytes at the end of %s. ", buf.size() - offset, path.c_str());
+  }
+  INFO("Replay %zu face journal records from %s. ", applied, path.c_str());
+  return 0;
+}
+
+int LoadFaceLibrarySnapshot(FaceGallery & gallery, uint32_t & journal_seq)
+{
+  journal_seq = 0;
+  if (0 == access(kFaceLibraryBin, F_OK)) {
+    if (0 != ReadFaceLibraryBin(kFaceLibraryBin, gallery, journal_seq)) {
+      return -1;
+    }
+    if (gallery.Size() >= kFaceIndexMinSize && 0 != ReadFaceIndexBin(kFaceIndexBin, gallery)) {
+      INFO("Rebuild face index of %zu faces. ", gallery.Size());
+      gallery.BuildIndex();
+      WriteFaceIndexBin(kFaceIndexBin, gallery);
+    }
+    return 0;
+  }
+
+  gallery.Clear();
+  if (0 != access(kFaceLibraryYaml, F_OK)) {
+    INFO("No face library found. ");
+    return 0;
+  }
+
+  // One time migration, the yaml file is left in place as a backup
+  INFO("Migrate face library from %s to %s. ", kFaceLibraryYaml, kFaceLibraryBin);
+  if (0 != ReadFaceLibraryYaml(kFaceLibraryYaml, gallery)) {
+    return -1;
+  }
+  gallery.BuildIndex();
+  if (0 != WriteFaceLibraryBin(kFaceLibraryBin, gallery, journal_seq)) {
+    WARN("Save migrated face library fail. ");
+  } else {
+    WriteFaceIndexBin(kFaceIndexBin, gallery);
+  }
+  return 0;
+}
+
+}  // namespace cyberdog_vision
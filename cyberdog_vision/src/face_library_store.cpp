@@ -0,0 +1,265 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+
+#include "cyberdog_vision/face_library_store.hpp"
+#include "cyberdog_common/cyberdog_log.hpp"
+
+namespace cyberdog_vision
+{
+
+FaceLibraryStore::FaceLibraryStore()
+: compact_thread_(nullptr), pending_seq_(0), seq_(0), journal_size_(0), compact_base_(0),
+  compact_size_th_(64 * 1024), journal_fd_(-1), has_pending_(false),
+  is_compacting_(false), is_exit_(false)
+{}
+
+int FaceLibraryStore::Load(
+  FaceGallery & gallery, uint32_t max_seq, uint32_t & journal_seq,
+  size_t & valid_size)
+{
+  journal_seq = 0;
+  valid_size = 0;
+  if (0 != LoadFaceLibrarySnapshot(gallery, journal_seq)) {
+    return -1;
+  }
+  ReplayFaceJournal(kFaceJournalOld, gallery, journal_seq, valid_size, max_seq);
+  ReplayFaceJournal(kFaceJournal, gallery, journal_seq, valid_size, max_seq);
+  return 0;
+}
+
+int FaceLibraryStore::Open(FaceGallery & gallery)
+{
+  std::unique_lock<std::mutex> lk(mtx_);
+  uint32_t journal_seq = 0;
+  size_t valid_size = 0;
+  bool has_old = (0 == access(kFaceJournalOld, F_OK));
+  if (0 != Load(gallery, UINT32_MAX, journal_seq, valid_size)) {
+    return -1;
+  }
+  seq_ = journal_seq;
+
+  // Cut off a torn record so new records are appended after valid data
+  journal_fd_ = open(kFaceJournal, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (journal_fd_ < 0) {
+    WARN("Open face journal %s fail. ", kFaceJournal);
+    return -1;
+  }
+  if (0 != ftruncate(journal_fd_, valid_size)) {
+    WARN("Truncate face journal fail. ");
+  }
+  if (0 != SyncParentDir(kFaceJournal)) {
+    close(journal_fd_);
+    journal_fd_ = -1;
+    return -1;
+  }
+  journal_size_ = valid_size;
+  compact_base_ = 0;
+
+  if (compact_thread_ == nullptr) {
+    compact_thread_ = std::make_shared<std::thread>(&FaceLibraryStore::CompactProc, this);
+  }
+
+  // Finish a compaction interrupted before the old journal was removed
+  if (has_old) {
+    pending_seq_ = seq_;
+    has_pending_ = true;
+    cond_.notify_all();
+  }
+  return 0;
+}
+
+int FaceLibraryStore::Load(FaceGallery & gallery)
+{
+  // Snapshot and old journal are swapped by the compaction, wait it out
+  std::unique_lock<std::mutex> lk(mtx_);
+  cond_.wait(lk, [this] {return (!has_pending_ && !is_compacting_) || is_exit_;});
+  uint32_t journal_seq = 0;
+  size_t valid_size = 0;
+  if (0 != Load(gallery, UINT32_MAX, journal_seq, valid_size) || journal_seq != seq_) {
+    WARN("Read back face library fail at journal seq %u. ", journal_seq);
+    return -1;
+  }
+  return 0;
+}
+
+int FaceLibraryStore::Add(
+  const std::string & name, const std::vector<std::vector<float>> & templates,
+  const std::vector<float> & weights, bool is_host)
+{
+  FaceJournalRecord record;
+  record.op = kJournalAdd;
+  record.name = name;
+  record.is_host = is_host;
+  record.templates = templates;
+  record.weights = weights;
+  return Append(record);
+}
+
+int FaceLibraryStore::Rename(const std::string & ori_name, const std::string & new_name)
+{
+  FaceJournalRecord record;
+  record.op = kJournalRename;
+  record.name = ori_name;
+  record.new_name = new_name;
+  return Append(record);
+}
+
+int FaceLibraryStore::Delete(const std::string & name)
+{
+  FaceJournalRecord record;
+  record.op = kJournalDelete;
+  record.name = name;
+  return Append(record);
+}
+
+int FaceLibraryStore::Append(FaceJournalRecord & record)
+{
+  std::unique_lock<std::mutex> lk(mtx_);
+  if (journal_fd_ < 0) {
+    WARN("Face journal is not opened. ");
+    return -1;
+  }
+
+  record.seq = seq_ + 1;
+  std::vector<uint8_t> buf;
+  EncodeJournalRecord(record, buf);
+  size_t written = 0;
+  while (written < buf.size()) {
+    ssize_t n = write(journal_fd_, buf.data() + written, buf.size() - written);
+    if (n <= 0) {
+      break;
+    }
+    written += n;
+  }
+  if (written < buf.size() || 0 != fdatasync(journal_fd_)) {
+    // Drop the torn record so later records do not land behind it
+    WARN("Write face journal fail. ");
+    if (0 != ftruncate(journal_fd_, journal_size_)) {
+      WARN("Truncate face journal fail. ");
+    }
+    return -1;
+  }
+  seq_ = record.seq;
+  journal_size_ += buf.size();
+  return 0;
+}
+
+bool FaceLibraryStore::NeedCompaction()
+{
+  std::unique_lock<std::mutex> lk(mtx_);
+  return journal_size_ - compact_base_ >= compact_size_th_ && !has_pending_ && !is_compacting_;
+}
+
+void FaceLibraryStore::Compact()
+{
+  std::unique_lock<std::mutex> lk(mtx_);
+  if (has_pending_ || is_compacting_ || journal_fd_ < 0) {
+    return;
+  }
+
+  // Rotate the journal, records after this point go to a fresh file. An old
+  // journal left by a failed snapshot is kept and covered by this snapshot.
+  if (0 != access(kFaceJournalOld, F_OK)) {
+    close(journal_fd_);
+    if (0 != rename(kFaceJournal, kFaceJournalOld)) {
+      WARN("Rotate face journal fail. ");
+    }
+    journal_fd_ = open(kFaceJournal, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal_fd_ < 0) {
+      WARN("Open face journal %s fail. ", kFaceJournal);
+    } else if (0 != SyncParentDir(kFaceJournal)) {
+      close(journal_fd_);
+      journal_fd_ = -1;
+    }
+    journal_size_ = 0;
+  }
+  compact_base_ = journal_size_;
+
+  pending_seq_ = seq_;
+  has_pending_ = true;
+  cond_.notify_all();
+}
+
+void FaceLibraryStore::CompactProc()
+{
+  while (true) {
+    FaceGallery gallery;
+    uint32_t journal_seq;
+    {
+      std::unique_lock<std::mutex> lk(mtx_);
+      cond_.wait(lk, [this] {return has_pending_ || is_exit_;});
+      if (is_exit_) {
+        return;
+      }
+      journal_seq = pending_seq_;
+      has_pending_ = false;
+      is_compacting_ = true;
+    }
+
+    // Only this thread swaps the snapshot and the old journal, and records
+    // appended meanwhile are past journal_seq
+    uint32_t loaded_seq = 0;
+    size_t valid_size = 0;
+    if (0 != Load(gallery, journal_seq, loaded_seq, valid_size) || loaded_seq != journal_seq) {
+      WARN("Read back face library fail at journal seq %u, keep journal. ", loaded_seq);
+    } else if (0 == WriteFaceLibraryBin(kFaceLibraryBin, gallery, journal_seq)) {
+      if ((0 != unlink(kFaceJournalOld) && errno != ENOENT) ||
+        0 != SyncParentDir(kFaceJournalOld))
+      {
+        WARN("Remove old face journal fail, replayed on next load. ");
+      }
+      // Rows replayed from the journal were only inserted, train them in
+      if (gallery.Size() >= kFaceIndexMinSize && gallery.Index().TrainedSize() != gallery.Size()) {
+        gallery.BuildIndex();
+      }
+      if (0 != WriteFaceIndexBin(kFaceIndexBin, gallery)) {
+        WARN("Save face index fail, rebuild on next load. ");
+      }
+      INFO("Face library snapshot saved at journal seq %d. ", journal_seq);
+    } else {
+      WARN("Save face library snapshot fail, keep journal. ");
+    }
+
+    std::unique_lock<std::mutex> lk(mtx_);
+    is_compacting_ = false;
+    cond_.notify_all();
+  }
+}
+
+FaceLibraryStore::~FaceLibraryStore()
+{
+  {
+    std::unique_lock<std::mutex> lk(mtx_);
+    is_exit_ = true;
+    cond_.notify_all();
+  }
+  if (compact_thread_ != nullptr && compact_thread_->joinable()) {
+    compact_thread_->join();
+  }
+  if (journal_fd_ >= 0) {
+    close(journal_fd_);
+  }
+}
+
+}  // namespace cyberdog_vision
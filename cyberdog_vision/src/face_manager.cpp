@@ -21,38 +21,21 @@
 #include <algorithm>
 #include <memory>
 #include <utility>
-#include <numeric>
+#include <cmath>
 
 #include "cyberdog_vision/face_manager.hpp"
+#include "cyberdog_vision/face_library_file.hpp"
 #include "cyberdog_common/cyberdog_log.hpp"
 #include "protocol/msg/face_result.hpp"
 
 namespace cyberdog_vision
 {
 
-static const char * label_path = "/home/mi/.faces/faceinfo.yaml";
-// key value to judge whether face is legal or not.
-static const float FACE_NUMBER_STABLE_VAL = 0.0f;
-static const float FACE_POSE_STABLE_THRES = 3.0f;
-static const float FACE_POSE_YAW_LEGAL_THRES = 30.0f;
-static const float FACE_POSE_PITCH_LEGAL_THRES = 20.0f;
-static const float FACE_POSE_ROW_LEGAL_THRES = 30.0f;
-static const float FACE_AREA_STABLE_THRES = 0.0010f;
-static const float FACE_AREA_LEGAL_THRES = 0.005f;
-
-void get_mean_stdev(std::vector<float> & vec, float & mean, double & stdev)
-{
-  size_t count = vec.size();
-  float sum = std::accumulate(vec.begin(), vec.end(), 0.0);
-  mean = sum / count;
-
-  double accum = 0.0;
-  for (size_t i = 0; i < count; i++) {
-    accum += (vec[i] - mean) * (vec[i] - mean);
-  }
-
-  stdev = sqrt(accum / count);
-}
+// face number is stable only when every frame of the window agrees
+static const double FACE_NUMBER_STABLE_EPS = 1e-3;
+static const float FACE_TEMPLATE_POSE_GAP = 10.0f;
+// library identities probed when the feature precision changes
+static const size_t FACE_QUANT_PROBES = 256;
 
 FaceManager * FaceManager::getInstance()
 {
@@ -61,18 +44,32 @@ FaceManager * FaceManager::getInstance()
 }
 
 FaceManager::FaceManager()
+: m_gallery(std::make_shared<FaceGallery>()), m_precision(kFeatFp32)
 {
   m_inFaceAdding = false;
+  m_version = 0;
+  m_indexPending = false;
+  m_indexExit = false;
+  setEnrollParams(m_enrollParams);
+  m_indexThread = std::make_shared<std::thread>(&FaceManager::indexProc, this);
   initialize();
 }
 
 FaceManager::~FaceManager()
 {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_indexExit = true;
+    m_indexCond.notify_one();
+  }
+  if (m_indexThread != nullptr && m_indexThread->joinable()) {
+    m_indexThread->join();
+  }
 }
 
 const std::string FaceManager::getFaceDataPath()
 {
-  return label_path;
+  return kFaceLibraryBin;
 }
 
 void FaceManager::initialize()
@@ -82,102 +79,150 @@ void FaceManager::initialize()
   }
 }
 
-std::map<std::string, std::vector<float>> & FaceManager::getFeatures()
+std::shared_ptr<const FaceGallery> FaceManager::getSnapshot()
 {
-  std::lock_guard<std::mutex> lock(m_mutex);
+  return std::atomic_load(&m_gallery);
+}
+
+void FaceManager::publishSnapshot(const std::shared_ptr<const FaceGallery> & gallery)
+{
+  std::atomic_store(&m_gallery, gallery);
+}
 
-  return m_features;
+std::shared_ptr<FaceGallery> FaceManager::copySnapshot()
+{
+  return std::make_shared<FaceGallery>(*getSnapshot());
 }
 
-bool FaceManager::updateFeaturesFile()
+void FaceManager::scheduleIndex(const FaceGallery & gallery)
 {
-  std::map<std::string, std::vector<float>>::iterator feature_iter;
-
-  string faceinfofile = std::string(label_path);
-  string face_name;
-  bool is_host;
-  vector<float> face_feature;
-  cv::FileStorage fs(faceinfofile, cv::FileStorage::WRITE);
-  if (!fs.isOpened()) {
-    INFO("cannot open xml file to write.");
-    return false;
+  ++m_version;
+  if (gallery.NeedIndex()) {
+    m_indexPending = true;
+    m_indexCond.notify_one();
   }
-  fs << "UserFaceInfo" << "[";
-  for (feature_iter = m_features.begin(); feature_iter != m_features.end(); feature_iter++) {
-    face_name = feature_iter->first;
-    face_feature = feature_iter->second;
-    is_host = m_hostMap[face_name];
-    fs << "{" << "name" << face_name << "is_host" << is_host << "feature" << face_feature << "}";
+}
+
+void FaceManager::indexProc()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_indexCond.wait(lock, [this] {return m_indexPending || m_indexExit;});
+    if (m_indexExit) {
+      return;
+    }
+    m_indexPending = false;
+    std::shared_ptr<FaceGallery> gallery = copySnapshot();
+    uint64_t version = m_version;
+
+    /* k-means over every row, writers and recognition go on meanwhile */
+    lock.unlock();
+    gallery->BuildIndex();
+    lock.lock();
+    if (version != m_version) {
+      /* the change that moved the version scheduled another pass */
+      continue;
+    }
+    INFO("Face index trained over %zu faces.", gallery->Size());
+    publishSnapshot(gallery);
+  }
+}
+
+void FaceManager::compactFeaturesFile()
+{
+  if (m_store.NeedCompaction()) {
+    m_store.Compact();
   }
-  fs << "]";
-  fs.release();
-  return true;
 }
 
 bool FaceManager::loadFeatures()
 {
   std::lock_guard<std::mutex> lock(m_mutex);
 
-  if (access(label_path, 0) != 0) {
+  if (access(kFaceLibraryDir, 0) != 0) {
     INFO("faces path not found.");
     umask(0);
-    mkdir("/home/mi/.faces/", 0755);
-    return true;
+    mkdir(kFaceLibraryDir, 0755);
   }
 
-  std::string faceinfofile = std::string(label_path);
-  int is_host;
-  std::string face_name;
-  vector<float> face_feature;
-
-  cv::FileStorage file_read(faceinfofile, cv::FileStorage::READ);
-  if (!file_read.isOpened()) {
-    INFO("cannot open yaml file to write");
+  auto gallery = std::make_shared<FaceGallery>();
+  if (0 != m_store.Open(*gallery)) {
+    INFO("cannot load face library file");
     return false;
   }
 
-  cv::FileNode UserFaceInfo = file_read["UserFaceInfo"];
-  for (cv::FileNodeIterator it = UserFaceInfo.begin(); it != UserFaceInfo.end(); ++it) {
-    (*it)["name"] >> face_name;
-    (*it)["feature"] >> face_feature;
-    (*it)["is_host"] >> is_host;
+  for (size_t i = 0; i < gallery->Size(); ++i) {
+    INFO(
+      "Load known face info  %s host: %d", gallery->Name(i).c_str(),
+      static_cast<int>(gallery->IsHost(i)));
+  }
+  gallery->SetPrecision(m_precision);
+  scheduleIndex(*gallery);
+  publishSnapshot(gallery);
 
-    m_features[face_name] = face_feature;
-    m_hostMap[face_name] = is_host;
+  return true;
+}
 
-    INFO("Load known face info  %s host: %d", face_name.c_str(), static_cast<int>(is_host));
+void FaceManager::setEnrollParams(const FaceEnrollParams & params)
+{
+  m_enrollParams = params;
+  for (int i = 0; i < statsFaceTypeMax; ++i) {
+    m_faceStats[i].SetWindow(params.window);
   }
-  file_read.release();
+}
 
-  return true;
+void FaceManager::setFeatPrecision(FeatPrecision precision)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_precision == precision) {
+    return;
+  }
+
+  /* quantized from the float library on disk, never from a quantized one,
+   * which only lives until the report is done */
+  FaceGallery reference;
+  if (0 != m_store.Load(reference)) {
+    WARN("Keep face library %s, float library unreadable.", FeatPrecisionName(m_precision));
+    return;
+  }
+  m_precision = precision;
+  auto gallery = std::make_shared<FaceGallery>(reference);
+  gallery->SetPrecision(precision);
+  QuantReport report;
+  MeasureQuantError(reference, *gallery, FACE_QUANT_PROBES, report);
+  INFO(
+    "Face library fp32 -> %s, %zu -> %zu bytes, score delta mean %.5f max %.5f "
+    "top1 agree %.3f over %zu probes", FeatPrecisionName(precision), reference.Bytes(),
+    gallery->Bytes(), report.mean_delta, report.max_delta, report.top1_agree, report.probes);
+  scheduleIndex(*gallery);
+  publishSnapshot(gallery);
 }
 
 int FaceManager::checkFacePose(std::vector<EntryFaceInfo> & faceinfos, std::string & msg)
 {
-  float mean[5];
-  double stdev[5];
+  const FaceEnrollParams & params = m_enrollParams;
 
-  m_faceStats[statsFaceNum].push_back(faceinfos.size());
+  m_faceStats[statsFaceNum].Push(faceinfos.size());
   if (faceinfos.size() != 1) {
-    m_faceStats[statsFaceYaw].push_back(0.0f);
-    m_faceStats[statsFacePitch].push_back(0.0f);
-    m_faceStats[statsFaceRow].push_back(0.0f);
-    m_faceStats[statsFaceArea].push_back(0.0f);
+    m_faceStats[statsFaceYaw].Push(0.0f);
+    m_faceStats[statsFacePitch].Push(0.0f);
+    m_faceStats[statsFaceRow].Push(0.0f);
+    m_faceStats[statsFaceArea].Push(0.0f);
   } else {
-    m_faceStats[statsFaceYaw].push_back(faceinfos[0].poses[0]);
-    m_faceStats[statsFacePitch].push_back(faceinfos[0].poses[1]);
-    m_faceStats[statsFaceRow].push_back(faceinfos[0].poses[2]);
-    m_faceStats[statsFaceArea].push_back(
+    m_faceStats[statsFaceYaw].Push(faceinfos[0].poses[0]);
+    m_faceStats[statsFacePitch].Push(faceinfos[0].poses[1]);
+    m_faceStats[statsFaceRow].Push(faceinfos[0].poses[2]);
+    m_faceStats[statsFaceArea].Push(
       static_cast<float>((faceinfos[0].rect.right - faceinfos[0].rect.left) *
       (faceinfos[0].rect.bottom - faceinfos[0].rect.top)) / (640 * 480));
   }
 
   // 1.face number should be exactly 1
-  if (m_faceStats[statsFaceNum].full()) {
-    get_mean_stdev(m_faceStats[statsFaceNum].vector(), mean[statsFaceNum], stdev[statsFaceNum]);
-    if (stdev[statsFaceNum] == FACE_NUMBER_STABLE_VAL) {
-      if (mean[statsFaceNum] == 1.0f) {
-      } else if (mean[statsFaceNum] == 0.0f) {
+  if (m_faceStats[statsFaceNum].Full()) {
+    double mean = m_faceStats[statsFaceNum].Mean();
+    if (m_faceStats[statsFaceNum].Stdev() <= FACE_NUMBER_STABLE_EPS) {
+      if (fabs(mean - 1.0) <= FACE_NUMBER_STABLE_EPS) {
+      } else if (fabs(mean) <= FACE_NUMBER_STABLE_EPS) {
         msg = "No face found!!";
         return protocol::msg::FaceResult::RESULT_NO_FACE_FOUND;
       } else {
@@ -194,10 +239,9 @@ int FaceManager::checkFacePose(std::vector<EntryFaceInfo> & faceinfos, std::stri
   }
 
   // face distance
-  if (m_faceStats[statsFaceArea].full()) {
-    get_mean_stdev(m_faceStats[statsFaceArea].vector(), mean[statsFaceArea], stdev[statsFaceArea]);
-    if (stdev[statsFaceArea] < FACE_AREA_STABLE_THRES) {
-      if (mean[statsFaceArea] > FACE_AREA_LEGAL_THRES) {
+  if (m_faceStats[statsFaceArea].Full()) {
+    if (m_faceStats[statsFaceArea].Stdev() < params.area_stable_thres) {
+      if (m_faceStats[statsFaceArea].Mean() > params.area_legal_thres) {
       } else {
         msg = "Distance is NOT OK!!";
         return protocol::msg::FaceResult::RESULT_DISTANCE_NOT_SATISFIED;
@@ -209,38 +253,36 @@ int FaceManager::checkFacePose(std::vector<EntryFaceInfo> & faceinfos, std::stri
   }
 
   // 3.face pose
-  if (m_faceStats[statsFaceYaw].full() &&
-    m_faceStats[statsFacePitch].full() &&
-    m_faceStats[statsFaceRow].full())
+  if (m_faceStats[statsFaceYaw].Full() &&
+    m_faceStats[statsFacePitch].Full() &&
+    m_faceStats[statsFaceRow].Full())
   {
-    get_mean_stdev(m_faceStats[statsFaceYaw].vector(), mean[statsFaceYaw], stdev[statsFaceYaw]);
-    get_mean_stdev(
-      m_faceStats[statsFacePitch].vector(), mean[statsFacePitch],
-      stdev[statsFacePitch]);
-    get_mean_stdev(m_faceStats[statsFaceRow].vector(), mean[statsFaceRow], stdev[statsFaceRow]);
-    if (stdev[statsFaceYaw] < FACE_POSE_STABLE_THRES &&
-      stdev[statsFacePitch] < FACE_POSE_STABLE_THRES &&
-      stdev[statsFaceRow] < FACE_POSE_STABLE_THRES)
+    double yaw = m_faceStats[statsFaceYaw].Mean();
+    double pitch = m_faceStats[statsFacePitch].Mean();
+    double row = m_faceStats[statsFaceRow].Mean();
+    if (m_faceStats[statsFaceYaw].Stdev() < params.pose_stable_thres &&
+      m_faceStats[statsFacePitch].Stdev() < params.pose_stable_thres &&
+      m_faceStats[statsFaceRow].Stdev() < params.pose_stable_thres)
     {
-      if (abs(mean[statsFaceYaw]) <= FACE_POSE_YAW_LEGAL_THRES &&
-        abs(mean[statsFacePitch]) <= FACE_POSE_PITCH_LEGAL_THRES &&
-        abs(mean[statsFaceRow]) <= FACE_POSE_ROW_LEGAL_THRES)
+      if (fabs(yaw) <= params.yaw_legal_thres &&
+        fabs(pitch) <= params.pitch_legal_thres &&
+        fabs(row) <= params.row_legal_thres)
       {
         msg = "check Face Pose success!!";
         return protocol::msg::FaceResult::RESULT_SUCCESS;
-      } else if (mean[statsFaceYaw] > FACE_POSE_YAW_LEGAL_THRES) {
+      } else if (yaw > params.yaw_legal_thres) {
         msg = "Degree is NOT OK: HEAD_LEFT!!";
         return protocol::msg::FaceResult::RESULT_DEGREE_HEAD_LEFT;
-      } else if (mean[statsFaceYaw] < -FACE_POSE_YAW_LEGAL_THRES) {
+      } else if (yaw < -params.yaw_legal_thres) {
         msg = "Degree is NOT OK: HEAD_RIGHT!!";
         return protocol::msg::FaceResult::RESULT_DEGREE_HEAD_RIGHT;
-      } else if (mean[statsFacePitch] > FACE_POSE_PITCH_LEGAL_THRES) {
+      } else if (pitch > params.pitch_legal_thres) {
         msg = "Degree is NOT OK: HEAD_DOWN";
         return protocol::msg::FaceResult::RESULT_DEGREE_HEAD_DOWN;
-      } else if (mean[statsFacePitch] < -FACE_POSE_PITCH_LEGAL_THRES) {
+      } else if (pitch < -params.pitch_legal_thres) {
         msg = "Degree is NOT OK: HEAD_UP!!";
         return protocol::msg::FaceResult::RESULT_DEGREE_HEAD_UP;
-      } else if (abs(mean[statsFaceRow]) > FACE_POSE_ROW_LEGAL_THRES) {
+      } else if (fabs(row) > params.row_legal_thres) {
         msg = "Degree is NOT OK: HEAD_TILT !!";
         return protocol::msg::FaceResult::RESULT_DEGREE_HEAD_TILT;
       } else {
@@ -260,21 +302,75 @@ int FaceManager::checkFacePose(std::vector<EntryFaceInfo> & faceinfos, std::stri
 
 int FaceManager::addFaceIDCacheInfo(std::string & name, bool is_host)
 {
+  /* every enrollment starts with an empty stability window, the stats are
+   * only touched by the enrollment worker that calls this */
+  for (int i = 0; i < statsFaceTypeMax; ++i) {
+    m_faceStats[i].Clear();
+  }
+  std::lock_guard<std::mutex> lock(m_cacheMutex);
   m_faceIdCached.is_host = is_host;
   m_faceIdCached.name = name;
+  m_faceTemplatesCached.clear();
 
   return true;
 }
 
+int FaceManager::offerFaceTemplate(std::vector<EntryFaceInfo> & faceinfo)
+{
+  if (faceinfo.size() != 1 || faceinfo[0].feats.empty() || faceinfo[0].poses.size() < 2) {
+    return -1;
+  }
+  float yaw = faceinfo[0].poses[0];
+  float pitch = faceinfo[0].poses[1];
+  if (fabs(yaw) > m_enrollParams.yaw_legal_thres ||
+    fabs(pitch) > m_enrollParams.pitch_legal_thres)
+  {
+    return -1;
+  }
+
+  /* frontal and confident faces weigh more */
+  FaceTemplate tmpl;
+  tmpl.feat = faceinfo[0].feats;
+  tmpl.yaw = yaw;
+  tmpl.pitch = pitch;
+  tmpl.quality = faceinfo[0].score * cos(yaw * M_PI / 180.f) * cos(pitch * M_PI / 180.f);
+
+  std::lock_guard<std::mutex> lock(m_cacheMutex);
+  /* a close pose keeps only the better one */
+  for (auto & cached : m_faceTemplatesCached) {
+    if (fabs(cached.yaw - yaw) < FACE_TEMPLATE_POSE_GAP &&
+      fabs(cached.pitch - pitch) < FACE_TEMPLATE_POSE_GAP)
+    {
+      if (tmpl.quality > cached.quality) {
+        cached = tmpl;
+      }
+      return 0;
+    }
+  }
+  if (m_faceTemplatesCached.size() < kMaxFaceTemplates) {
+    m_faceTemplatesCached.push_back(tmpl);
+    return 0;
+  }
+  auto worst = std::min_element(
+    m_faceTemplatesCached.begin(), m_faceTemplatesCached.end(),
+    [](const FaceTemplate & a, const FaceTemplate & b) {
+      return a.quality < b.quality;
+    });
+  if (tmpl.quality > worst->quality) {
+    *worst = tmpl;
+  }
+  return 0;
+}
+
 int FaceManager::addFaceFeatureCacheInfo(std::vector<EntryFaceInfo> & faceinfo)
 {
-  m_faceFeatsCached = faceinfo[0].feats;
-  return true;
+  return offerFaceTemplate(faceinfo) == 0;
 }
 
 int FaceManager::cancelAddFace()
 {
-  m_faceFeatsCached.clear();
+  std::lock_guard<std::mutex> lock(m_cacheMutex);
+  m_faceTemplatesCached.clear();
   m_faceIdCached.name = "";
   m_faceIdCached.is_host = false;
   return 0;
@@ -282,64 +378,103 @@ int FaceManager::cancelAddFace()
 
 int FaceManager::confirmFace(std::string & name, bool is_host)
 {
-  std::string filename;
-  INFO(
-    "confirm last face name:  %s, is_host: %d", m_faceIdCached.name,
-    static_cast<int>(m_faceIdCached.is_host));
-
-  if (m_faceIdCached.name.compare(name) != 0 || is_host != m_faceIdCached.is_host) {
-    INFO("confirmFace face name: %s but cache name: %s", name.c_str(), m_faceIdCached.name.c_str());
-    return -1;
+  std::vector<std::vector<float>> templates;
+  std::vector<float> weights;
+  {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    INFO(
+      "confirm last face name:  %s, is_host: %d", m_faceIdCached.name.c_str(),
+      static_cast<int>(m_faceIdCached.is_host));
+
+    if (m_faceIdCached.name.compare(name) != 0 || is_host != m_faceIdCached.is_host) {
+      INFO(
+        "confirmFace face name: %s but cache name: %s", name.c_str(),
+        m_faceIdCached.name.c_str());
+      return -1;
+    }
+    for (auto & cached : m_faceTemplatesCached) {
+      templates.push_back(cached.feat);
+      weights.push_back(cached.quality);
+    }
+    m_faceTemplatesCached.clear();
   }
-  if (m_faceFeatsCached.empty()) {
+  if (templates.empty()) {
     INFO("Error:faceFeatsCached empty...");
     return -1;
   }
-  m_mutex.lock();
-  m_features[m_faceIdCached.name] = m_faceFeatsCached;
-  m_hostMap[m_faceIdCached.name] = m_faceIdCached.is_host;
-  m_mutex.unlock();
+  INFO("confirmFace %s with %zu templates", name.c_str(), templates.size());
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    /* a change that is not on disk is not applied either */
+    if (0 != m_store.Add(name, templates, weights, is_host)) {
+      ERROR("Failed to save face %s.", name.c_str());
+      return -1;
+    }
+    /* new templates are stored at the precision of the library */
+    std::shared_ptr<FaceGallery> gallery = copySnapshot();
+    gallery->Add(name, templates, weights, is_host);
+    scheduleIndex(*gallery);
+    publishSnapshot(gallery);
+    compactFeaturesFile();
+  }
 
-  updateFeaturesFile();
   /* clear face cache */
-  m_faceFeatsCached.clear();
-  m_faceIdCached.name = "";
-  m_faceIdCached.is_host = false;
-  // m_faceCacheSize = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    m_faceIdCached.name = "";
+    m_faceIdCached.is_host = false;
+  }
 
   return 0;
 }
 
 int FaceManager::updateFaceId(std::string & ori_name, std::string & new_name)
 {
-  if (m_features.find(ori_name) == m_features.end()) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!getSnapshot()->Find(ori_name)) {
     INFO("Face name not found %s", ori_name.c_str());
     return -1;
   }
+  if (ori_name == new_name) {
+    return 0;
+  }
+  // The gallery would drop the identity already holding the name
+  if (getSnapshot()->Find(new_name)) {
+    ERROR("Face name %s already exists.", new_name.c_str());
+    return -1;
+  }
 
-  m_mutex.lock();
-  m_features[new_name] = m_features[ori_name];
-  m_features.erase(ori_name);
-  m_hostMap[new_name] = m_hostMap[ori_name];
-  m_hostMap.erase(ori_name);
-  m_mutex.unlock();
-  updateFeaturesFile();
+  if (0 != m_store.Rename(ori_name, new_name)) {
+    ERROR("Failed to save face name %s.", new_name.c_str());
+    return -1;
+  }
+  std::shared_ptr<FaceGallery> gallery = copySnapshot();
+  gallery->Rename(ori_name, new_name);
+  // Also keeps an index build started before the rename from publishing
+  scheduleIndex(*gallery);
+  publishSnapshot(gallery);
+  compactFeaturesFile();
   return 0;
 }
 
 int FaceManager::deleteFace(std::string & face_name)
 {
-  if (m_features.find(face_name) == m_features.end()) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!getSnapshot()->Find(face_name)) {
     INFO("Face name not found %s", face_name.c_str());
     return 0;
   }
 
-  m_mutex.lock();
-  m_features.erase(face_name);
-  m_hostMap.erase(face_name);
-  m_mutex.unlock();
-
-  updateFeaturesFile();
+  if (0 != m_store.Delete(face_name)) {
+    ERROR("Failed to save deletion of face %s.", face_name.c_str());
+    return -1;
+  }
+  std::shared_ptr<FaceGallery> gallery = copySnapshot();
+  gallery->Remove(face_name);
+  scheduleIndex(*gallery);
+  publishSnapshot(gallery);
+  compactFeaturesFile();
 
   return 0;
 }
@@ -347,16 +482,16 @@ int FaceManager::deleteFace(std::string & face_name)
 
 std::string FaceManager::getAllFaces()
 {
-  std::string all_face_info;
-  std::string face_name;
-  int is_host;
-  std::map<std::string, std::vector<float>>::iterator feature_iter;
-
-  for (feature_iter = m_features.begin(); feature_iter != m_features.end(); feature_iter++) {
-    face_name = feature_iter->first;
-    is_host = m_hostMap[face_name];
+  std::shared_ptr<const FaceGallery> gallery = getSnapshot();
+  std::map<std::string, int> faces;
+  for (size_t i = 0; i < gallery->Size(); ++i) {
+    faces[gallery->Name(i)] = gallery->IsHost(i);
+  }
 
-    all_face_info = all_face_info + "id=" + face_name + ",host=" + std::to_string(is_host) + ";";
+  std::string all_face_info;
+  for (auto & face : faces) {
+    all_face_info = all_face_info + "id=" + face.first + ",host=" + std::to_string(face.second) +
+      ";";
   }
 
   return all_face_info;
@@ -365,13 +500,15 @@ std::string FaceManager::getAllFaces()
 
 bool FaceManager::findFace(const std::string & face_name)
 {
-  return m_features.find(face_name) != m_features.end();
+  return getSnapshot()->Find(face_name);
 }
 
 bool FaceManager::isHost(const std::string & face_name)
 {
-  if (m_hostMap.find(face_name) != m_hostMap.end()) {
-    return m_hostMap[face_name];
+  std::shared_ptr<const FaceGallery> gallery = getSnapshot();
+  size_t index;
+  if (gallery->GetIndex(face_name, index)) {
+    return gallery->IsHost(index);
   }
 
   return false;
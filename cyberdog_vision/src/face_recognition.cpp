@@ -12,9 +12,13 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <math.h>
+
 #include <string>
 #include <vector>
 #include <map>
+#include <chrono>
+#include <algorithm>
 
 #include "cyberdog_vision/face_recognition.hpp"
 #include "cyberdog_common/cyberdog_log.hpp"
@@ -22,26 +26,62 @@
 namespace cyberdog_vision
 {
 
+// Attribute passes see a crop this many face sizes wide around each face
+static const float kAttrCropScale = 2.f;
+// A crop holds one large face, so its detection runs at a small input
+static const int kAttrDetScale = 160;
+
 FaceRecognition::FaceRecognition(
   const std::string & model_path, bool open_emotion, bool open_age)
+: face_ptr_(nullptr), attr_ptr_(nullptr), attr_inline_(false), feat_thres_(kFaceMatchThres),
+  match_count_(0), match_ms_(0.0), attr_count_(0), attr_ms_(0.0)
 {
   INFO("===Init FaceRecognition===");
-  face_ptr_ = XMFaceAPI::Create();
+  face_ptr_ = CreateSdk(model_path, false, false, false);
+  if (face_ptr_ == nullptr) {
+    throw std::logic_error("Init face recognition algo fial. ");
+  }
+  if (open_emotion || open_age) {
+    INFO("Open face attributes, emotion: %d, age: %d", open_emotion, open_age);
+    attr_ptr_ = CreateSdk(model_path, open_emotion, open_age, true);
+  }
+  if ((open_emotion || open_age) && attr_ptr_ == nullptr) {
+    // The sdk wants the feature model in every instance, keep one instance
+    // and take the attributes from the recognition pass
+    WARN("Open face attributes without feature model fail, run them with recognition. ");
+    XMFaceAPI::Destroy(face_ptr_);
+    face_ptr_ = CreateSdk(model_path, open_emotion, open_age, false);
+    if (face_ptr_ == nullptr) {
+      throw std::logic_error("Init face recognition algo fial. ");
+    }
+    attr_inline_ = true;
+  }
+
+  std::string version;
+  if (!face_ptr_->getVersion(version)) {
+    INFO("Version of face sdk is %s", version.c_str());
+  }
+}
 
+XMFaceAPI * FaceRecognition::CreateSdk(
+  const std::string & model_path, bool open_emotion, bool open_age, bool attr_only)
+{
+  XMFaceAPI * sdk = XMFaceAPI::Create();
   FaceParam param;
   FillParam(model_path, param);
   param.open_emotion = open_emotion;
   param.open_age = open_age;
   param.det_scale = 512;
-  param.feat_thres = 0.65;
-  if (!face_ptr_->init(param)) {
-    throw std::logic_error("Init face recognition algo fial. ");
+  param.feat_thres = kFaceMatchThres;
+  if (attr_only) {
+    param.feat_mf.clear();
+    param.det_scale = kAttrDetScale;
   }
-
-  std::string version;
-  if (!face_ptr_->getVersion(version)) {
-    INFO("Version of face sdk is %s", version.c_str());
+  if (!sdk->init(param)) {
+    XMFaceAPI::Destroy(sdk);
+    return nullptr;
   }
+  return sdk;
 }
 
 int FaceRecognition::GetFaceInfo(const cv::Mat & img, std::vector<EntryFaceInfo> & faces_info)
@@ -54,19 +94,223 @@ int FaceRecognition::GetFaceInfo(const cv::Mat & img, std::vector<EntryFaceInfo>
   return 0;
 }
 
+int FaceRecognition::GetFaceAttributes(
+  const cv::Mat & img, const std::vector<EntryFaceInfo> & entries,
+  const std::vector<bool> & usable, std::vector<EntryFaceInfo> & faces_info)
+{
+  faces_info.clear();
+  if (attr_inline_) {
+    faces_info = entries;
+    return 0;
+  }
+  if (attr_ptr_ == nullptr) {
+    return -1;
+  }
+
+  // Only the crops around the usable faces are searched again
+  int ret = 0;
+  for (size_t i = 0; i < entries.size() && i < usable.size(); ++i) {
+    if (!usable[i]) {
+      std::unique_lock<std::mutex> lk(quality_mtx_);
+      quality_stats_.skipped_attr++;
+      if (attr_count_ > 0) {
+        quality_stats_.attr_saved_ms += attr_ms_ / attr_count_;
+      }
+      continue;
+    }
+    const XMFaceRect & rect = entries[i].rect;
+    float width = (rect.right - rect.left) * kAttrCropScale;
+    float height = (rect.bottom - rect.top) * kAttrCropScale;
+    int left = cvRound((rect.left + rect.right - width) / 2);
+    int top = cvRound((rect.top + rect.bottom - height) / 2);
+    cv::Rect crop = ClampRect(cv::Rect(left, top, cvRound(width), cvRound(height)), img);
+    if (crop.area() == 0) {
+      continue;
+    }
+    auto start = std::chrono::steady_clock::now();
+    cv::Mat crop_img = img(crop).clone();
+    XMImage xm_img;
+    ImgConvert(crop_img, xm_img);
+    std::vector<EntryFaceInfo> found;
+    bool found_ok = attr_ptr_->getFaceInfo(xm_img, found);
+    double cost = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+    {
+      std::unique_lock<std::mutex> lk(quality_mtx_);
+      attr_ms_ += cost;
+      attr_count_++;
+    }
+    if (!found_ok) {
+      ret = -1;
+      continue;
+    }
+    // The crop may catch part of a neighbour, keep its largest face
+    auto best = std::max_element(
+      found.begin(), found.end(), [](const EntryFaceInfo & a, const EntryFaceInfo & b) {
+        return (a.rect.right - a.rect.left) * (a.rect.bottom - a.rect.top) <
+        (b.rect.right - b.rect.left) * (b.rect.bottom - b.rect.top);
+      });
+    if (best == found.end()) {
+      continue;
+    }
+    best->rect.left += crop.x;
+    best->rect.right += crop.x;
+    best->rect.top += crop.y;
+    best->rect.bottom += crop.y;
+    faces_info.push_back(*best);
+  }
+  return ret;
+}
+
+bool FaceRecognition::HasAttributes() const
+{
+  return attr_ptr_ != nullptr || attr_inline_;
+}
+
 int FaceRecognition::GetRecognitionResult(
-  const cv::Mat & img, const std::map<std::string,
-  std::vector<float>> & endlib_feats,
+  const cv::Mat & img, const FaceGallery & gallery,
+  std::vector<MatchFaceInfo> & faces_info)
+{
+  faces_info.clear();
+  std::vector<EntryFaceInfo> entry_infos;
+  if (0 != GetFaceInfo(img, entry_infos)) {
+    return -1;
+  }
+
+  // Match features against gallery instead of passing the library into sdk
+  for (auto & entry : entry_infos) {
+    MatchFaceInfo info;
+    info.rect = entry.rect;
+    info.score = entry.score;
+    info.poses = entry.poses;
+    info.emotions = entry.emotions;
+    info.ages = entry.ages;
+    if (CheckQuality(img, entry)) {
+      MatchFace(entry, gallery, info);
+    } else {
+      info.face_id.clear();
+      info.match_score = 0.f;
+      info.emotions.clear();
+      info.ages.clear();
+    }
+    faces_info.push_back(info);
+  }
+  return 0;
+}
+
+void FaceRecognition::MatchFace(
+  const EntryFaceInfo & entry, const FaceGallery & gallery,
+  MatchFaceInfo & face_info)
+{
+  auto start = std::chrono::steady_clock::now();
+  std::vector<GalleryMatch> matches;
+  face_info.face_id.clear();
+  face_info.match_score = 0.f;
+  gallery.Query(entry.feats, 1, matches);
+  if (!matches.empty() && matches[0].score > feat_thres_) {
+    face_info.face_id = gallery.Name(matches[0].index);
+    face_info.match_score = matches[0].score;
+  }
+
+  double cost = std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+  std::unique_lock<std::mutex> lk(quality_mtx_);
+  match_ms_ += cost;
+  match_count_++;
+}
+
+void FaceRecognition::SetMatchThres(float thres)
+{
+  feat_thres_ = thres;
+}
+
+float FaceRecognition::GetMatchThres() const
+{
+  return feat_thres_;
+}
+
+int FaceRecognition::GetSdkMatchResult(
+  const cv::Mat & img, const std::map<std::string, std::vector<float>> & library,
   std::vector<MatchFaceInfo> & faces_info)
 {
   XMImage xm_img;
   ImgConvert(img, xm_img);
-  if (!face_ptr_->getMatchInfo(xm_img, endlib_feats, faces_info)) {
+  if (!face_ptr_->getMatchInfo(xm_img, library, faces_info)) {
     return -1;
   }
   return 0;
 }
 
+void FaceRecognition::SetQualityParams(const FaceQualityParams & params)
+{
+  std::unique_lock<std::mutex> lk(quality_mtx_);
+  quality_params_ = params;
+}
+
+bool FaceRecognition::CheckQuality(const cv::Mat & img, const EntryFaceInfo & entry)
+{
+  FaceQualityParams params;
+  {
+    std::unique_lock<std::mutex> lk(quality_mtx_);
+    params = quality_params_;
+    quality_stats_.checked++;
+  }
+
+  cv::Rect rect(
+    entry.rect.left, entry.rect.top, entry.rect.right - entry.rect.left,
+    entry.rect.bottom - entry.rect.top);
+  uint64_t * skipped = nullptr;
+  if (entry.poses.size() >= 3 &&
+    (fabs(entry.poses[0]) > params.max_yaw || fabs(entry.poses[1]) > params.max_pitch ||
+    fabs(entry.poses[2]) > params.max_roll))
+  {
+    skipped = &quality_stats_.skipped_pose;
+  } else if (img.empty() || rect.area() < params.min_face_ratio * img.cols * img.rows) {
+    skipped = &quality_stats_.skipped_small;
+  } else if (Sharpness(img, rect) < params.min_sharpness) {
+    skipped = &quality_stats_.skipped_blur;
+  }
+  if (skipped == nullptr) {
+    return true;
+  }
+
+  std::unique_lock<std::mutex> lk(quality_mtx_);
+  (*skipped)++;
+  if (match_count_ > 0) {
+    quality_stats_.match_saved_ms += match_ms_ / match_count_;
+  }
+  return false;
+}
+
+FaceQualityStats FaceRecognition::GetQualityStats()
+{
+  std::unique_lock<std::mutex> lk(quality_mtx_);
+  return quality_stats_;
+}
+
+float FaceRecognition::Sharpness(const cv::Mat & img, const cv::Rect & rect)
+{
+  cv::Rect roi = ClampRect(rect, img);
+  if (roi.area() == 0) {
+    return 0.f;
+  }
+
+  // Measure on a fixed small scale so the cost does not grow with the face
+  const int kSharpnessWidth = 64;
+  cv::Mat gray, small, lap;
+  cv::cvtColor(img(roi), gray, cv::COLOR_BGR2GRAY);
+  if (gray.cols > kSharpnessWidth) {
+    int height = std::max(1, gray.rows * kSharpnessWidth / gray.cols);
+    cv::resize(gray, small, cv::Size(kSharpnessWidth, height), 0, 0, cv::INTER_AREA);
+  } else {
+    small = gray;
+  }
+  cv::Laplacian(small, lap, CV_32F);
+  cv::Scalar mean, stddev;
+  cv::meanStdDev(lap, mean, stddev);
+  return stddev[0] * stddev[0];
+}
+
 void FaceRecognition::FillParam(const std::string & model_path, FaceParam & param)
 {
   param.detect_mf = model_path + "/detect/mnetv2_gray_nop_light_epoch_235_512.onnx";
@@ -81,6 +325,9 @@ FaceRecognition::~FaceRecognition()
   if (face_ptr_ != nullptr) {
     XMFaceAPI::Destroy(face_ptr_);
   }
+  if (attr_ptr_ != nullptr) {
+    XMFaceAPI::Destroy(attr_ptr_);
+  }
 }
 
 }  // namespace cyberdog_vision
@@ -0,0 +1,300 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "cyberdog_vision/face_track_cache.hpp"
+
+namespace cyberdog_vision
+{
+
+static cv::Rect FaceRect(const XMFaceRect & rect)
+{
+  return cv::Rect(rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
+}
+
+static cv::Rect BodyRect(const HumanBodyInfo & body)
+{
+  return cv::Rect(body.left, body.top, body.width, body.height);
+}
+
+FaceTrackCache::FaceTrackCache()
+: detect_ns_(0)
+{}
+
+void FaceTrackCache::SetParams(const FaceTrackParams & params)
+{
+  params_ = params;
+}
+
+void FaceTrackCache::Clear()
+{
+  tracks_.clear();
+  pending_.clear();
+  pending_bodies_.clear();
+  pending_attr_ns_.clear();
+  detect_bodies_.clear();
+  detect_ns_ = 0;
+}
+
+bool FaceTrackCache::NeedDetect(uint64_t stamp_ns, const BodyFrameInfo & bodies) const
+{
+  // Faces can only be followed through their bodies
+  if (detect_ns_ == 0 || bodies.empty() || stamp_ns < detect_ns_ ||
+    stamp_ns - detect_ns_ >= params_.redetect_ns)
+  {
+    return true;
+  }
+
+  for (auto & track : tracks_) {
+    if (track.miss > 0) {
+      continue;
+    }
+    if (track.body.area() == 0 || FindBody(track.body, bodies) < 0) {
+      return true;
+    }
+    if (stamp_ns - track.match_ns >= params_.rematch_ns ||
+      (!track.info.face_id.empty() && track.info.match_score < params_.confident_score))
+    {
+      return true;
+    }
+  }
+
+  // A body not seen at the last sdk pass may bring a new face
+  for (auto & body : bodies) {
+    bool is_known = false;
+    for (auto & known : detect_bodies_) {
+      if (RectIoU(BodyRect(body), known) >= params_.iou_thres) {
+        is_known = true;
+        break;
+      }
+    }
+    if (!is_known) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FaceTrackCache::Associate(
+  uint64_t stamp_ns, const std::vector<EntryFaceInfo> & entries,
+  const BodyFrameInfo & bodies, std::vector<MatchFaceInfo> & faces,
+  std::vector<bool> & need_match)
+{
+  faces.clear();
+  need_match.assign(entries.size(), true);
+  pending_.assign(entries.size(), -1);
+  pending_bodies_.assign(entries.size(), cv::Rect());
+  pending_attr_ns_.assign(entries.size(), 0);
+
+  // Greedy assignment by descending iou
+  std::vector<std::pair<float, std::pair<size_t, size_t>>> pairs;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    for (size_t j = 0; j < tracks_.size(); ++j) {
+      float iou = RectIoU(FaceRect(entries[i].rect), FaceRect(tracks_[j].info.rect));
+      if (iou >= params_.iou_thres) {
+        pairs.push_back(std::make_pair(iou, std::make_pair(i, j)));
+      }
+    }
+  }
+  std::sort(
+    pairs.begin(), pairs.end(), [](
+      const std::pair<float, std::pair<size_t, size_t>> & a,
+      const std::pair<float, std::pair<size_t, size_t>> & b) {
+      return a.first > b.first;
+    });
+  std::vector<bool> track_used(tracks_.size(), false);
+  for (auto & pair : pairs) {
+    size_t face = pair.second.first;
+    size_t track = pair.second.second;
+    if (pending_[face] >= 0 || track_used[track]) {
+      continue;
+    }
+    pending_[face] = track;
+    track_used[track] = true;
+  }
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    MatchFaceInfo info;
+    info.rect = entries[i].rect;
+    info.score = entries[i].score;
+    info.poses = entries[i].poses;
+    info.emotions = entries[i].emotions;
+    info.ages = entries[i].ages;
+    info.match_score = 0.f;
+    if (pending_[i] >= 0) {
+      const FaceTrack & track = tracks_[pending_[i]];
+      bool is_fresh = stamp_ns >= track.match_ns &&
+        stamp_ns - track.match_ns < params_.rematch_ns;
+      bool is_confident = track.info.face_id.empty() ||
+        track.info.match_score >= params_.confident_score;
+      info.face_id = track.info.face_id;
+      info.match_score = track.info.match_score;
+      info.emotions = track.info.emotions;
+      info.ages = track.info.ages;
+      pending_attr_ns_[i] = track.attr_ns;
+      need_match[i] = !(is_fresh && is_confident);
+    }
+    int body = LinkBody(FaceRect(entries[i].rect), bodies);
+    if (body >= 0) {
+      pending_bodies_[i] = BodyRect(bodies[body]);
+    }
+    faces.push_back(info);
+  }
+
+  detect_ns_ = stamp_ns;
+  detect_bodies_.clear();
+  for (auto & body : bodies) {
+    detect_bodies_.push_back(BodyRect(body));
+  }
+}
+
+bool FaceTrackCache::NeedAttributes(uint64_t stamp_ns, const std::vector<bool> & usable) const
+{
+  for (size_t i = 0; i < pending_attr_ns_.size() && i < usable.size(); ++i) {
+    if (!usable[i]) {
+      continue;
+    }
+    uint64_t attr_ns = pending_attr_ns_[i];
+    if (attr_ns == 0 || stamp_ns < attr_ns || stamp_ns - attr_ns >= params_.attr_refresh_ns) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FaceTrackCache::ApplyAttributes(
+  uint64_t stamp_ns, const std::vector<EntryFaceInfo> & attrs,
+  const std::vector<bool> & usable, std::vector<MatchFaceInfo> & faces)
+{
+  for (size_t i = 0; i < faces.size() && i < pending_attr_ns_.size() && i < usable.size(); ++i) {
+    if (!usable[i]) {
+      continue;
+    }
+    int best = -1;
+    float best_iou = params_.iou_thres;
+    for (size_t j = 0; j < attrs.size(); ++j) {
+      float iou = RectIoU(FaceRect(faces[i].rect), FaceRect(attrs[j].rect));
+      if (iou >= best_iou) {
+        best = j;
+        best_iou = iou;
+      }
+    }
+    if (best >= 0) {
+      faces[i].emotions = attrs[best].emotions;
+      faces[i].ages = attrs[best].ages;
+    }
+    // A miss waits for the next refresh too, the pass is not retried
+    pending_attr_ns_[i] = stamp_ns;
+  }
+}
+
+void FaceTrackCache::Commit(
+  uint64_t stamp_ns, const std::vector<MatchFaceInfo> & faces,
+  const std::vector<bool> & matched)
+{
+  std::vector<FaceTrack> tracks;
+  std::vector<bool> track_used(tracks_.size(), false);
+  for (size_t i = 0; i < faces.size() && i < pending_.size(); ++i) {
+    FaceTrack track;
+    if (pending_[i] >= 0) {
+      track = tracks_[pending_[i]];
+      track_used[pending_[i]] = true;
+    }
+    if (i < matched.size() && matched[i]) {
+      track.match_ns = stamp_ns;
+    }
+    track.info = faces[i];
+    track.body = pending_bodies_[i];
+    track.attr_ns = pending_attr_ns_[i];
+    track.miss = 0;
+    tracks.push_back(track);
+  }
+
+  // Unseen tracks stay a few passes to bridge missed detections
+  for (size_t j = 0; j < tracks_.size(); ++j) {
+    if (!track_used[j] && tracks_[j].miss < params_.max_miss) {
+      tracks.push_back(tracks_[j]);
+      tracks.back().miss++;
+    }
+  }
+  tracks_.swap(tracks);
+  pending_.clear();
+}
+
+void FaceTrackCache::Predict(const BodyFrameInfo & bodies, std::vector<MatchFaceInfo> & faces)
+{
+  faces.clear();
+  for (auto & track : tracks_) {
+    if (track.miss > 0 || track.body.area() == 0) {
+      continue;
+    }
+    int index = FindBody(track.body, bodies);
+    if (index < 0) {
+      continue;
+    }
+
+    // Keep the face at the same relative place inside its body
+    cv::Rect body = BodyRect(bodies[index]);
+    float sx = static_cast<float>(body.width) / track.body.width;
+    float sy = static_cast<float>(body.height) / track.body.height;
+    XMFaceRect & rect = track.info.rect;
+    rect.left = body.x + (rect.left - track.body.x) * sx;
+    rect.right = body.x + (rect.right - track.body.x) * sx;
+    rect.top = body.y + (rect.top - track.body.y) * sy;
+    rect.bottom = body.y + (rect.bottom - track.body.y) * sy;
+    track.body = body;
+    faces.push_back(track.info);
+  }
+}
+
+int FaceTrackCache::LinkBody(const cv::Rect & face, const BodyFrameInfo & bodies) const
+{
+  // The face center has to lie in the upper half of the body
+  int cx = face.x + face.width / 2;
+  int cy = face.y + face.height / 2;
+  int best = -1;
+  int best_area = 0;
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    cv::Rect body = BodyRect(bodies[i]);
+    if (cx < body.x || cx >= body.x + body.width || cy < body.y ||
+      cy >= body.y + body.height / 2)
+    {
+      continue;
+    }
+    if (best < 0 || body.area() < best_area) {
+      best = i;
+      best_area = body.area();
+    }
+  }
+  return best;
+}
+
+int FaceTrackCache::FindBody(const cv::Rect & body, const BodyFrameInfo & bodies) const
+{
+  int best = -1;
+  float best_iou = params_.iou_thres;
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    float iou = RectIoU(body, BodyRect(bodies[i]));
+    if (iou >= best_iou) {
+      best = i;
+      best_iou = iou;
+    }
+  }
+  return best;
+}
+
+}  // namespace cyberdog_vision
@@ -0,0 +1,232 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <math.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "cyberdog_vision/feature_quant.hpp"
+
+namespace cyberdog_vision
+{
+
+// Codes span [-kInt8Max, kInt8Max], symmetric around the row offset
+const float kInt8Max = 127.f;
+
+const char * FeatPrecisionName(FeatPrecision precision)
+{
+  switch (precision) {
+    case kFeatFp16:
+      return "fp16";
+    case kFeatInt8:
+      return "int8";
+    default:
+      return "fp32";
+  }
+}
+
+bool ParseFeatPrecision(const std::string & name, FeatPrecision & precision)
+{
+  if (name == "fp32") {
+    precision = kFeatFp32;
+  } else if (name == "fp16") {
+    precision = kFeatFp16;
+  } else if (name == "int8") {
+    precision = kFeatInt8;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+FeatureRows::FeatureRows()
+: precision_(kFeatFp32), stride_(0), rows_(0)
+{}
+
+void FeatureRows::Reset(FeatPrecision precision, size_t stride)
+{
+  precision_ = precision;
+  stride_ = stride;
+  rows_ = 0;
+  fp32_.clear();
+  fp16_.clear();
+  int8_.clear();
+  scales_.clear();
+  offsets_.clear();
+}
+
+void FeatureRows::Convert(FeatPrecision precision)
+{
+  if (precision == precision_) {
+    return;
+  }
+  AlignedFloats rows(rows_ * stride_);
+  for (size_t row = 0; row < rows_; ++row) {
+    Get(row, &rows[row * stride_]);
+  }
+  size_t count = rows_;
+  Reset(precision, stride_);
+  Assign(rows.data(), count);
+}
+
+void FeatureRows::Resize(size_t rows)
+{
+  rows_ = rows;
+  switch (precision_) {
+    case kFeatFp16:
+      fp16_.resize(rows_ * stride_, 0);
+      break;
+    case kFeatInt8:
+      int8_.resize(rows_ * stride_, 0);
+      scales_.resize(rows_, 0.f);
+      offsets_.resize(rows_, 0.f);
+      break;
+    default:
+      fp32_.resize(rows_ * stride_, 0.f);
+      break;
+  }
+}
+
+void FeatureRows::Assign(const float * rows, size_t count)
+{
+  if (precision_ == kFeatFp32) {
+    rows_ = count;
+    fp32_.assign(rows, rows + count * stride_);
+    return;
+  }
+  Resize(count);
+  for (size_t row = 0; row < count; ++row) {
+    Set(row, rows + row * stride_);
+  }
+}
+
+void FeatureRows::Set(size_t row, const float * feat)
+{
+  switch (precision_) {
+    case kFeatFp16: {
+        uint16_t * dst = &fp16_[row * stride_];
+        for (size_t i = 0; i < stride_; ++i) {
+          dst[i] = FloatToHalf(feat[i]);
+        }
+        break;
+      }
+    case kFeatInt8: {
+        // Center the codes on the row range so its full width is used
+        float min_value = feat[0];
+        float max_value = feat[0];
+        for (size_t i = 1; i < stride_; ++i) {
+          min_value = std::min(min_value, feat[i]);
+          max_value = std::max(max_value, feat[i]);
+        }
+        float offset = 0.5f * (max_value + min_value);
+        float scale = 0.5f * (max_value - min_value) / kInt8Max;
+        float inv = scale > 0.f ? 1.f / scale : 0.f;
+        int8_t * dst = &int8_[row * stride_];
+        for (size_t i = 0; i < stride_; ++i) {
+          float code = roundf((feat[i] - offset) * inv);
+          dst[i] = static_cast<int8_t>(std::min(std::max(code, -kInt8Max), kInt8Max));
+        }
+        scales_[row] = scale;
+        offsets_[row] = offset;
+        break;
+      }
+    default:
+      memcpy(&fp32_[row * stride_], feat, sizeof(float) * stride_);
+      break;
+  }
+}
+
+void FeatureRows::Get(size_t row, float * feat) const
+{
+  switch (precision_) {
+    case kFeatFp16: {
+        const uint16_t * src = &fp16_[row * stride_];
+        for (size_t i = 0; i < stride_; ++i) {
+          feat[i] = HalfToFloat(src[i]);
+        }
+        break;
+      }
+    case kFeatInt8: {
+        const int8_t * src = &int8_[row * stride_];
+        for (size_t i = 0; i < stride_; ++i) {
+          feat[i] = scales_[row] * src[i] + offsets_[row];
+        }
+        break;
+      }
+    default:
+      memcpy(feat, &fp32_[row * stride_], sizeof(float) * stride_);
+      break;
+  }
+}
+
+void FeatureRows::Move(size_t from, size_t to)
+{
+  switch (precision_) {
+    case kFeatFp16:
+      memcpy(&fp16_[to * stride_], &fp16_[from * stride_], sizeof(uint16_t) * stride_);
+      break;
+    case kFeatInt8:
+      memcpy(&int8_[to * stride_], &int8_[from * stride_], stride_);
+      scales_[to] = scales_[from];
+      offsets_[to] = offsets_[from];
+      break;
+    default:
+      memcpy(&fp32_[to * stride_], &fp32_[from * stride_], sizeof(float) * stride_);
+      break;
+  }
+}
+
+float FeatureRows::Dot(const float * query, float query_sum, size_t row) const
+{
+  switch (precision_) {
+    case kFeatFp16:
+      return DotHalf(query, &fp16_[row * stride_], stride_);
+    case kFeatInt8:
+      return scales_[row] * DotInt8(query, &int8_[row * stride_], stride_) +
+             offsets_[row] * query_sum;
+    default:
+      return cyberdog_vision::Dot(query, &fp32_[row * stride_], stride_);
+  }
+}
+
+FeatPrecision FeatureRows::Precision() const
+{
+  return precision_;
+}
+
+size_t FeatureRows::Rows() const
+{
+  return rows_;
+}
+
+size_t FeatureRows::Stride() const
+{
+  return stride_;
+}
+
+size_t FeatureRows::Bytes() const
+{
+  return fp32_.size() * sizeof(float) + fp16_.size() * sizeof(uint16_t) + int8_.size() +
+         (scales_.size() + offsets_.size()) * sizeof(float);
+}
+
+const float * FeatureRows::Data() const
+{
+  return precision_ == kFeatFp32 ? fp32_.data() : nullptr;
+}
+
+}  // namespace cyberdog_vision
@@ -41,16 +41,25 @@ int GestureRecognition::GetGestureInfo(
     return -1;
   }
 
+  // The sdk crops from the full frame itself, boxes only need clipping
   std::vector<handgesture::bbox> infer_bboxes;
   for (auto & body : body_boxes) {
+    cv::Rect box = ClampRect(body.body_box, img);
+    if (box.area() == 0) {
+      continue;
+    }
     handgesture::bbox infer_bbox;
-    infer_bbox.xmin = body.body_box.x;
-    infer_bbox.ymin = body.body_box.y;
-    infer_bbox.xmax = body.body_box.x + body.body_box.width;
-    infer_bbox.ymax = body.body_box.y + body.body_box.height;
+    infer_bbox.xmin = box.x;
+    infer_bbox.ymin = box.y;
+    infer_bbox.xmax = box.x + box.width;
+    infer_bbox.ymax = box.y + box.height;
     infer_bbox.score = body.score;
     infer_bboxes.push_back(infer_bbox);
   }
+  if (infer_bboxes.empty()) {
+    WARN("Have no body inside image to detect gesture. ");
+    return -1;
+  }
 
   XMImage xm_img;
   ImgConvert(img, xm_img);
@@ -40,27 +40,37 @@ void KeypointsDetection::GetKeypointsInfo(
     return;
   }
 
+  // Boxes are clipped to the image, bodies fully outside keep an empty
+  // keypoints entry so the result stays aligned with body_boxes
   XMImage xm_img;
   ImgConvert(img, xm_img);
   std::vector<pbox> infer_bboxes;
-  for (auto & infer_bbox : body_boxes) {
-    XMPoint point_tl = XMPoint(infer_bbox.body_box.x, infer_bbox.body_box.y);
-    XMPoint point_br = XMPoint(
-      infer_bbox.body_box.x + infer_bbox.body_box.width,
-      infer_bbox.body_box.y + infer_bbox.body_box.height);
+  std::vector<size_t> body_index;
+  for (size_t i = 0; i < body_boxes.size(); ++i) {
+    cv::Rect box = ClampRect(body_boxes[i].body_box, img);
+    if (box.area() == 0) {
+      continue;
+    }
+    XMPoint point_tl = XMPoint(box.x, box.y);
+    XMPoint point_br = XMPoint(box.x + box.width, box.y + box.height);
     infer_bboxes.push_back({point_tl, point_br});
+    body_index.push_back(i);
+  }
+  bodies_keypoints.resize(body_boxes.size());
+  if (infer_bboxes.empty()) {
+    WARN("No person inside image cannot extract keypoints. ");
+    return;
   }
 
   bool is_save_keypoints = false;
   bool is_show_names = false;
   keypoints_ptr_->Inference(xm_img, infer_bboxes, is_save_keypoints, is_show_names);
   std::vector<std::vector<XMPoint>> xm_points = keypoints_ptr_->Get_Persons_Keypoints();
-  for (size_t i = 0; i < xm_points.size(); ++i) {
-    std::vector<cv::Point2f> single_body_keypoints;
+  for (size_t i = 0; i < xm_points.size() && i < body_index.size(); ++i) {
+    std::vector<cv::Point2f> & single_body_keypoints = bodies_keypoints[body_index[i]];
     for (size_t j = 0; j < xm_points[i].size(); ++j) {
       single_body_keypoints.push_back(cv::Point2f(xm_points[i][j].x, xm_points[i][j].y));
     }
-    bodies_keypoints.push_back(single_body_keypoints);
   }
 }
 
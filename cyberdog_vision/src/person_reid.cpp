@@ -12,39 +12,111 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <math.h>
+
 #include <string>
 #include <vector>
+#include <utility>
+#include <algorithm>
 
 #include "cyberdog_vision/person_reid.hpp"
+#include "cyberdog_vision/assignment.hpp"
+#include "cyberdog_vision/reid_gallery_file.hpp"
 #include "cyberdog_common/cyberdog_log.hpp"
 
-const int kFeatLen = 128;
+const int kReIDMaxCrops = 8;
+const int kReIDGateMisses = 5;
+// Chi-square quantile of 2 dof at 99%, gate on the squared center distance
+const float kReIDGateChi2 = 9.21;
+// Motion noise in units of the target box height
+const float kMotionPosNoise = 0.05;
+const float kMotionVelNoise = 0.02;
+const float kMotionMeasNoise = 0.1;
+// Assignment cost of a target and body that may not be matched
+const float kReIDNoMatchCost = 1e3;
+const double kReIDRecoverSec = 60.;
+const int kReIDRecoverInterval = 10;
+// Overlap with a body turned down at the last scan that marks it as known
+const float kReIDRejectIoU = 0.3;
 namespace cyberdog_vision
 {
 
+static int64_t WallNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 PersonReID::PersonReID(const std::string & model_path)
-: gpu_id_(0), tracking_id_(0), object_loss_th_(300), library_frame_num_(15), unmatch_count_(0),
-  feat_sim_th_(0.8), feat_update_th_(0.9), is_tracking_(false), is_lost_(true), reid_ptr_(nullptr)
+: gpu_id_(0), tracking_id_(0), object_loss_th_(300), library_frame_num_(15), feat_len_(0),
+  model_tag_(0),
+  max_crops_(kReIDMaxCrops), max_targets_(1), gate_misses_(kReIDGateMisses),
+  recover_interval_(kReIDRecoverInterval), frame_count_(0), recover_sec_(kReIDRecoverSec),
+  feat_sim_th_(0.8), feat_update_th_(0.9), is_tracking_(false), is_lost_(true),
+  recover_new_only_(false), gallery_policy_(kGalleryDiverse),
+  gallery_precision_(kFeatFp32), reid_ptr_(nullptr)
 {
   INFO("===Init PersonReID===");
   std::string model_reid = model_path + "/reid_v4_mid.engine";
   if (0 != REID_Init(reid_ptr_, model_reid.c_str(), gpu_id_)) {
     throw std::logic_error("Init person reid algo fail. ");
   }
+  model_tag_ = ReIDModelTag(model_reid);
+  // Galleries and similarity follow the length of the loaded model
+  feat_len_ = REID_GetFeatLen();
+  if (feat_len_ <= 0) {
+    throw std::logic_error("Get person reid feature length fail. ");
+  }
+  INFO("Reid feature length: %d", feat_len_);
 }
 
 int PersonReID::SetTracker(
   const cv::Mat & img, const cv::Rect & body_box,
   std::vector<float> & reid_feat)
 {
+  std::vector<ReIDTarget> targets;
+  targets.swap(targets_);
+  int id;
+  if (0 != AddTracker(img, body_box, id, reid_feat)) {
+    targets.swap(targets_);
+    return -1;
+  }
+  return 0;
+}
+
+int PersonReID::AddTracker(
+  const cv::Mat & img, const cv::Rect & body_box, int & id,
+  std::vector<float> & reid_feat)
+{
+  if (static_cast<int>(targets_.size()) >= max_targets_) {
+    // A new selection takes the place of a lost target
+    for (size_t t = 0; t < targets_.size(); ++t) {
+      if (targets_[t].recovering) {
+        INFO("Drop lost target %d for the new one. ", targets_[t].id);
+        targets_.erase(targets_.begin() + t);
+        break;
+      }
+    }
+  }
+  if (static_cast<int>(targets_.size()) >= max_targets_) {
+    WARN("Reid already follows %zu targets. ", targets_.size());
+    return -1;
+  }
   if (0 != GetFeature(img, body_box, reid_feat)) {
     WARN("GetFeature fail. ");
     return -1;
   }
-  tracker_feat_.assign(reid_feat.begin(), reid_feat.end());
-  if (is_tracking_) {
-    tracking_id_++;
-  }
+  targets_.push_back(ReIDTarget());
+  ReIDTarget & target = targets_.back();
+  target.id = tracking_id_++;
+  target.unmatch_count = 0;
+  target.recovering = false;
+  target.gallery = MakeReIDGallery(
+    reid_feat.size(), library_frame_num_, gallery_policy_, gallery_precision_);
+  target.gallery->Push(reid_feat.data(), WallNs());
+  target.last_tracked = body_box;
+  InitMotion(target, body_box);
+  id = target.id;
   is_tracking_ = true;
   is_lost_ = false;
 
@@ -55,68 +127,274 @@ int PersonReID::GetReIDInfo(
   const cv::Mat & img, const std::vector<InferBbox> & body_bboxes,
   int & id, cv::Rect & tracked)
 {
-  if (tracker_feat_.empty()) {
+  id = -1;
+  tracked = cv::Rect(0, 0, 0, 0);
+  int primary = GetPrimaryId();
+  std::vector<ReIDMatch> matches;
+  if (0 != GetReIDInfos(img, body_bboxes, matches)) {
+    return -1;
+  }
+  for (auto & match : matches) {
+    if (match.id == primary) {
+      id = match.id;
+      tracked = match.box;
+    }
+  }
+  return 0;
+}
+
+int PersonReID::GetReIDInfos(
+  const cv::Mat & img, const std::vector<InferBbox> & body_bboxes,
+  std::vector<ReIDMatch> & matches)
+{
+  matches.clear();
+  if (targets_.empty()) {
     WARN("Please set tracker before tracking. ");
     return -1;
   }
 
-  id = -1;
-  tracked = cv::Rect(0, 0, 0, 0);
-  size_t index = 0;
-  float max_sim = 0;
-  std::vector<float> match_feat;
+  // Lost targets are only searched every recover_interval_ frames, with
+  // nothing else to follow the frames in between cost nothing
+  bool scan = ++frame_count_ % recover_interval_ == 0;
+  bool any_active = false;
+  for (auto & target : targets_) {
+    PredictMotion(target);
+    any_active = any_active || !target.recovering || scan;
+  }
+  if (!any_active) {
+    UpdateLost();
+    return 0;
+  }
+  std::vector<size_t> candidates;
   for (size_t i = 0; i < body_bboxes.size(); ++i) {
-    // For every body bbox
-    std::vector<float> feat;
-    if (0 != GetFeature(img, body_bboxes[i].body_box, feat)) {
-      return -1;
+    for (auto & target : targets_) {
+      if (IsCandidate(target, body_bboxes[i].body_box, scan)) {
+        candidates.push_back(i);
+        break;
+      }
     }
+  }
+  if (candidates.size() < body_bboxes.size()) {
+    INFO("Gated reid candidates: %zu of %zu", candidates.size(), body_bboxes.size());
+  }
+  SelectCandidates(body_bboxes, candidates);
+  std::vector<cv::Rect> boxes;
+  for (auto i : candidates) {
+    boxes.push_back(body_bboxes[i].body_box);
+  }
+  std::vector<std::vector<float>> feats;
+  if (0 != GetFeatures(img, boxes, feats)) {
+    return -1;
+  }
 
-    float sim_val = GetSim(feat, tracker_feat_, SimType::kSimOne2Group);
-    INFO("Object %d, sim: %f", i, sim_val);
-    if (sim_val > max_sim) {
-      index = i;
-      max_sim = sim_val;
-      match_feat.assign(feat.begin(), feat.end());
+  // Similarity of every target to every extracted body, pairs outside the
+  // gate or below the threshold cannot be assigned. A lost target needs a
+  // confident match to be followed again.
+  std::vector<std::vector<float>> sims(targets_.size(), std::vector<float>(candidates.size(), 0.f));
+  std::vector<std::vector<float>> costs(
+    targets_.size(), std::vector<float>(candidates.size(), kReIDNoMatchCost));
+  for (size_t t = 0; t < targets_.size(); ++t) {
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      if (feats[i].empty() || !IsCandidate(targets_[t], boxes[i], scan)) {
+        continue;
+      }
+      sims[t][i] = GetSim(targets_[t], feats[i], SimType::kSimOne2Group);
+      INFO("Target %d, object %zu, sim: %f", targets_[t].id, candidates[i], sims[t][i]);
+      float sim_th = targets_[t].recovering ? feat_update_th_ : feat_sim_th_;
+      if (sims[t][i] > sim_th) {
+        costs[t][i] = 1.f - sims[t][i];
+      }
     }
   }
+  std::vector<int> assign;
+  SolveAssignment(costs, assign);
 
-  if (max_sim > feat_sim_th_) {
-    // Match success
-    unmatch_count_ = 0;
-    id = tracking_id_;
-    tracked = body_bboxes[index].body_box;
-    INFO(
-      "Match success, sim: %f, bbox: %d,%d,%d,%d", max_sim, tracked.x, tracked.y, tracked.width,
-      tracked.height);
-    if (max_sim > feat_update_th_) {
-      // Update library feat
-      if (static_cast<int>(tracker_feat_.size()) / kFeatLen == library_frame_num_) {
-        tracker_feat_.erase(tracker_feat_.begin(), tracker_feat_.begin() + kFeatLen);
+  std::vector<bool> taken(candidates.size(), false);
+  for (size_t t = 0; t < targets_.size(); ++t) {
+    ReIDTarget & target = targets_[t];
+    int i = assign[t];
+    if (i >= 0 && costs[t][i] < kReIDNoMatchCost) {
+      if (target.recovering) {
+        INFO("Target %d recovered after %d misses. ", target.id, target.unmatch_count);
+        target.recovering = false;
       }
-      tracker_feat_.insert(tracker_feat_.end(), match_feat.begin(), match_feat.end());
+      taken[i] = true;
+      // Match success
+      ReIDMatch match;
+      match.id = target.id;
+      match.body_index = candidates[i];
+      match.sim = sims[t][i];
+      match.box = boxes[i];
+      matches.push_back(match);
+      target.unmatch_count = 0;
+      target.last_tracked = match.box;
+      CorrectMotion(target, match.box);
+      INFO(
+        "Target %d match success, sim: %f, bbox: %d,%d,%d,%d", target.id, match.sim,
+        match.box.x, match.box.y, match.box.width, match.box.height);
+      if (match.sim > feat_update_th_) {
+        // Update library feat, a full gallery replaces per its policy
+        target.gallery->Push(feats[i].data(), WallNs());
+      }
+    } else if (!target.recovering) {
+      WARN("Target %d match fail, current count: %d", target.id, target.unmatch_count);
+      target.unmatch_count++;
+    } else if (scan) {
+      target.unmatch_count++;
     }
-  } else {
-    WARN("Match fail, current count: %d", unmatch_count_);
-    unmatch_count_++;
-    if (unmatch_count_ > object_loss_th_) {
-      WARN("Object is lost. ");
-      is_lost_ = true;
-      ResetTracker();
+  }
+
+  if (scan) {
+    rejected_.clear();
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      if (!taken[i]) {
+        rejected_.push_back(boxes[i]);
+      }
     }
   }
+  UpdateLost();
   return 0;
 }
 
+void PersonReID::UpdateLost()
+{
+  auto now = std::chrono::steady_clock::now();
+  bool all_lost = true;
+  for (size_t t = targets_.size(); t > 0; --t) {
+    ReIDTarget & target = targets_[t - 1];
+    if (!target.recovering && target.unmatch_count > object_loss_th_) {
+      WARN("Target %d is lost, search it at a low rate. ", target.id);
+      target.recovering = true;
+      target.motion_ready = false;
+      target.lost_time = now;
+    }
+    if (target.recovering &&
+      std::chrono::duration<double>(now - target.lost_time).count() >= recover_sec_)
+    {
+      WARN("Target %d not recovered in %.1f s, drop its gallery. ", target.id, recover_sec_);
+      targets_.erase(targets_.begin() + (t - 1));
+      continue;
+    }
+    all_lost = all_lost && target.recovering;
+  }
+  is_lost_ = all_lost;
+  if (targets_.empty()) {
+    WARN("Object is lost. ");
+    ResetTracker();
+  }
+}
+
 int PersonReID::GetFeatureLen()
 {
-  return REID_GetFeatLen();
+  return feat_len_;
+}
+
+void PersonReID::SetMaxCrops(int max_crops)
+{
+  max_crops_ = std::max(max_crops, 1);
+}
+
+void PersonReID::SetGateMisses(int gate_misses)
+{
+  gate_misses_ = std::max(gate_misses, 0);
+}
+
+void PersonReID::SetMaxTargets(int max_targets)
+{
+  max_targets_ = std::max(max_targets, 1);
+}
+
+int PersonReID::GetMaxTargets()
+{
+  return max_targets_;
+}
+
+void PersonReID::SetRecovery(double recover_sec, int recover_interval, bool new_only)
+{
+  recover_sec_ = std::max(recover_sec, 0.);
+  recover_interval_ = std::max(recover_interval, 1);
+  recover_new_only_ = new_only;
+}
+
+void PersonReID::SetGallery(
+  int library_frame_num, GalleryPolicy policy,
+  FeatPrecision precision)
+{
+  library_frame_num_ = std::max(library_frame_num, 1);
+  gallery_policy_ = policy;
+  gallery_precision_ = precision;
+}
+
+int PersonReID::SaveGallery(const std::string & name)
+{
+  std::string path = ReIDGalleryPath(name);
+  if (path.empty() || targets_.empty()) {
+    WARN("No reid gallery to save as %s. ", name.c_str());
+    return -1;
+  }
+  if (0 != WriteReIDGallery(path, model_tag_, *targets_[0].gallery)) {
+    WARN("Save reid gallery %s fail. ", path.c_str());
+    return -1;
+  }
+  INFO("Save reid gallery %s, %zu features. ", path.c_str(), targets_[0].gallery->Size());
+  return 0;
+}
+
+int PersonReID::LoadGallery(const std::string & name, int & id)
+{
+  std::string path = ReIDGalleryPath(name);
+  std::unique_ptr<ReIDGalleryBase> gallery;
+  if (path.empty() ||
+    0 != ReadReIDGallery(path, model_tag_, library_frame_num_, gallery_policy_, gallery))
+  {
+    return -1;
+  }
+  if (static_cast<int>(gallery->Dim()) != feat_len_) {
+    WARN(
+      "Reid gallery %s holds %zu floats, model gives %d. ", path.c_str(), gallery->Dim(),
+      feat_len_);
+    return -1;
+  }
+  if (static_cast<int>(targets_.size()) >= max_targets_) {
+    WARN("Reid already follows %zu targets. ", targets_.size());
+    return -1;
+  }
+  if (gallery_precision_ != kFeatFp32) {
+    // The stored rows are the float reference of the quantized gallery
+    std::unique_ptr<ReIDGalleryBase> quantized = gallery->Clone();
+    quantized->SetPrecision(gallery_precision_);
+    QuantReport report;
+    MeasureQuantError(*gallery, *quantized, report);
+    INFO(
+      "Reid gallery fp32 -> %s, %zu -> %zu bytes, score delta mean %.5f max %.5f "
+      "top1 agree %.3f over %zu probes", FeatPrecisionName(gallery_precision_), gallery->Bytes(),
+      quantized->Bytes(), report.mean_delta, report.max_delta, report.top1_agree, report.probes);
+    gallery.swap(quantized);
+  }
+  targets_.push_back(ReIDTarget());
+  ReIDTarget & target = targets_.back();
+  target.id = tracking_id_++;
+  target.unmatch_count = 0;
+  target.motion_ready = false;
+  target.recovering = true;
+  target.lost_time = std::chrono::steady_clock::now();
+  target.gallery.swap(gallery);
+  id = target.id;
+  is_tracking_ = true;
+  INFO("Load reid gallery %s as target %d. ", path.c_str(), id);
+  return 0;
+}
+
+int PersonReID::GetPrimaryId()
+{
+  return targets_.empty() ? -1 : targets_[0].id;
 }
 
 void PersonReID::ResetTracker()
 {
   is_tracking_ = false;
-  tracker_feat_.clear();
+  targets_.clear();
+  rejected_.clear();
   tracking_id_++;
 }
 
@@ -130,43 +408,229 @@ int PersonReID::GetFeature(
   std::vector<float> & reid_feat)
 {
   reid_feat.clear();
-  cv::Mat reid_img = img(body_box).clone();
-  XMReIDImage xm_reid_img;
-  xm_reid_img.data = reid_img.data;
-  xm_reid_img.height = reid_img.rows;
-  xm_reid_img.width = reid_img.cols;
-  xm_reid_img.fmt = XM_IMG_FMT_BGR;
-  float * feat = nullptr;
-  if (0 != REID_ExtractFeat(reid_ptr_, &xm_reid_img, feat)) {
-    WARN("Extract reid feature fail.");
+  std::vector<std::vector<float>> feats;
+  if (0 != GetFeatures(img, std::vector<cv::Rect>(1, body_box), feats) || feats[0].empty()) {
     return -1;
   }
-  reid_feat.resize(GetFeatureLen());
-  if (feat != nullptr) {
-    memcpy(reid_feat.data(), feat, sizeof(float) * GetFeatureLen());
-    feat = nullptr;
+  reid_feat.swap(feats[0]);
+  return 0;
+}
+
+bool PersonReID::IsCandidate(const ReIDTarget & target, const cv::Rect & box, bool scan) const
+{
+  if (!target.recovering) {
+    return InGate(target, box);
+  }
+  if (!scan) {
+    return false;
+  }
+  if (recover_new_only_) {
+    for (auto & rejected : rejected_) {
+      if (RectIoU(box, rejected) > kReIDRejectIoU) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool PersonReID::InGate(const ReIDTarget & target, const cv::Rect & box) const
+{
+  if (!target.motion_ready || gate_misses_ == 0 || target.unmatch_count >= gate_misses_) {
+    return true;
+  }
+  return GateDistance(target, box) <= kReIDGateChi2;
+}
+
+void PersonReID::SelectCandidates(
+  const std::vector<InferBbox> & body_bboxes,
+  std::vector<size_t> & candidates)
+{
+  if (static_cast<int>(candidates.size()) <= max_crops_) {
+    return;
+  }
+
+  // Crowded frame, keep the bodies closest to where any target is expected
+  std::vector<cv::Point2f> centers;
+  for (auto & target : targets_) {
+    if (target.last_tracked.area() > 0) {
+      centers.push_back(TargetCenter(target));
+    }
+  }
+  if (!centers.empty()) {
+    std::vector<std::pair<float, size_t>> dists;
+    for (auto i : candidates) {
+      const cv::Rect & box = body_bboxes[i].body_box;
+      float min_dist = -1.f;
+      for (auto & center : centers) {
+        float dx = box.x + box.width * 0.5f - center.x;
+        float dy = box.y + box.height * 0.5f - center.y;
+        float dist = dx * dx + dy * dy;
+        if (min_dist < 0.f || dist < min_dist) {
+          min_dist = dist;
+        }
+      }
+      dists.push_back(std::make_pair(min_dist, i));
+    }
+    std::partial_sort(dists.begin(), dists.begin() + max_crops_, dists.end());
+    for (int i = 0; i < max_crops_; ++i) {
+      candidates[i] = dists[i].second;
+    }
+  }
+  candidates.resize(max_crops_);
+}
+
+int PersonReID::GetFeatures(
+  const cv::Mat & img, const std::vector<cv::Rect> & boxes,
+  std::vector<std::vector<float>> & feats)
+{
+  feats.assign(boxes.size(), std::vector<float>());
+  std::vector<cv::Rect> rois(boxes.size());
+  size_t total = 0;
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    rois[i] = ClampRect(boxes[i], img);
+    if (rois[i].area() > 0 && !img(rois[i]).isContinuous()) {
+      total += rois[i].area() * img.elemSize();
+    }
+  }
+
+  // The sdk image has no stride, so only views spanning whole rows go in
+  // as they are. The rest are staged back to back in one buffer reused
+  // across frames.
+  if (crop_buf_.size() < total) {
+    crop_buf_.resize(total);
+  }
+  uint8_t * ptr = crop_buf_.data();
+  for (size_t i = 0; i < rois.size(); ++i) {
+    if (rois[i].area() == 0) {
+      continue;
+    }
+    cv::Mat crop = img(rois[i]);
+    if (!crop.isContinuous()) {
+      cv::Mat staged(rois[i].height, rois[i].width, img.type(), ptr);
+      crop.copyTo(staged);
+      ptr += rois[i].area() * img.elemSize();
+      crop = staged;
+    }
+
+    XMReIDImage xm_reid_img;
+    xm_reid_img.data = crop.data;
+    xm_reid_img.height = crop.rows;
+    xm_reid_img.width = crop.cols;
+    xm_reid_img.fmt = XM_IMG_FMT_BGR;
+    float * feat = nullptr;
+    if (0 != REID_ExtractFeat(reid_ptr_, &xm_reid_img, feat)) {
+      WARN("Extract reid feature fail.");
+      return -1;
+    }
+    if (feat != nullptr) {
+      feats[i].assign(feat, feat + feat_len_);
+    }
   }
   return 0;
 }
 
+void PersonReID::InitMotion(ReIDTarget & target, const cv::Rect & box)
+{
+  // State cx, cy, w, h, vx, vy, one step per reid frame
+  target.motion.init(6, 4, 0, CV_32F);
+  cv::setIdentity(target.motion.transitionMatrix);
+  target.motion.transitionMatrix.at<float>(0, 4) = 1.f;
+  target.motion.transitionMatrix.at<float>(1, 5) = 1.f;
+  target.motion.measurementMatrix = cv::Mat::zeros(4, 6, CV_32F);
+  for (int i = 0; i < 4; ++i) {
+    target.motion.measurementMatrix.at<float>(i, i) = 1.f;
+  }
+
+  // Noise follows the box height so near and far targets gate alike
+  float scale = std::max(box.height, 1);
+  float pos_var = kMotionPosNoise * scale * kMotionPosNoise * scale;
+  float vel_var = kMotionVelNoise * scale * kMotionVelNoise * scale;
+  float meas_var = kMotionMeasNoise * scale * kMotionMeasNoise * scale;
+  target.motion.processNoiseCov = cv::Mat::zeros(6, 6, CV_32F);
+  target.motion.errorCovPost = cv::Mat::zeros(6, 6, CV_32F);
+  for (int i = 0; i < 6; ++i) {
+    target.motion.processNoiseCov.at<float>(i, i) = i < 4 ? pos_var : vel_var;
+    target.motion.errorCovPost.at<float>(i, i) = i < 4 ? meas_var : meas_var * 4.f;
+  }
+  cv::setIdentity(target.motion.measurementNoiseCov, cv::Scalar(meas_var));
+
+  target.motion.statePost = cv::Mat::zeros(6, 1, CV_32F);
+  target.motion.statePost.at<float>(0) = box.x + box.width * 0.5f;
+  target.motion.statePost.at<float>(1) = box.y + box.height * 0.5f;
+  target.motion.statePost.at<float>(2) = box.width;
+  target.motion.statePost.at<float>(3) = box.height;
+  target.motion_ready = true;
+}
+
+void PersonReID::PredictMotion(ReIDTarget & target)
+{
+  // Misses keep predicting, so the gate widens with the uncertainty
+  if (target.motion_ready) {
+    target.motion.predict();
+  }
+}
+
+void PersonReID::CorrectMotion(ReIDTarget & target, const cv::Rect & box)
+{
+  if (!target.motion_ready || GateDistance(target, box) > kReIDGateChi2) {
+    // Found by the full search, the old motion says nothing about it
+    InitMotion(target, box);
+    return;
+  }
+  cv::Mat measure(4, 1, CV_32F);
+  measure.at<float>(0) = box.x + box.width * 0.5f;
+  measure.at<float>(1) = box.y + box.height * 0.5f;
+  measure.at<float>(2) = box.width;
+  measure.at<float>(3) = box.height;
+  target.motion.correct(measure);
+}
+
+float PersonReID::GateDistance(const ReIDTarget & target, const cv::Rect & box) const
+{
+  // Mahalanobis distance of the box center under the predicted covariance
+  const cv::Mat & cov = target.motion.errorCovPre;
+  const cv::Mat & noise = target.motion.measurementNoiseCov;
+  float sxx = cov.at<float>(0, 0) + noise.at<float>(0, 0);
+  float sxy = cov.at<float>(0, 1) + noise.at<float>(0, 1);
+  float syy = cov.at<float>(1, 1) + noise.at<float>(1, 1);
+  float det = sxx * syy - sxy * sxy;
+  if (det <= 0.f) {
+    return 0.f;
+  }
+  float dx = box.x + box.width * 0.5f - target.motion.statePre.at<float>(0);
+  float dy = box.y + box.height * 0.5f - target.motion.statePre.at<float>(1);
+  return (syy * dx * dx - 2.f * sxy * dx * dy + sxx * dy * dy) / det;
+}
+
+cv::Point2f PersonReID::TargetCenter(const ReIDTarget & target) const
+{
+  if (target.motion_ready) {
+    return cv::Point2f(target.motion.statePre.at<float>(0), target.motion.statePre.at<float>(1));
+  }
+  return cv::Point2f(
+    target.last_tracked.x + target.last_tracked.width * 0.5f,
+    target.last_tracked.y + target.last_tracked.height * 0.5f);
+}
+
 float PersonReID::GetSim(
-  std::vector<float> & feat_det, std::vector<float> & feat_library,
+  const ReIDTarget & target, const std::vector<float> & feat_det,
   const SimType & sim_type)
 {
-  float sim_value;
+  float sim_value = 0.f;
+  size_t dim = target.gallery->Dim();
+  if (target.gallery->Size() == 0 || feat_det.size() < dim || feat_det.size() % dim != 0) {
+    return sim_value;
+  }
   switch (sim_type) {
     case SimType::kSimOne2One:
-      sim_value = REID_GetSimOfOne2One(reid_ptr_, feat_det.data(), feat_library.data());
+      sim_value = Cosine(feat_det.data(), target.gallery->Newest(), dim);
       break;
     case SimType::kSimOne2Group:
-      sim_value = REID_GetSimOfOne2Group(
-        reid_ptr_, feat_det.data(),
-        feat_library.data(), feat_library.size() / kFeatLen);
+      sim_value = target.gallery->One2Group(feat_det.data());
       break;
     case SimType::kSimGroup2Group:
-      sim_value = REID_GetSimOfGroup2Group(
-        reid_ptr_, feat_det.data(),
-        feat_det.size() / kFeatLen, feat_library.data(), feat_library.size() / kFeatLen);
+      sim_value = target.gallery->Group2Group(feat_det.data(), feat_det.size() / dim);
       break;
   }
   return sim_value;
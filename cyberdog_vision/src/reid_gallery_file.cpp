@@ -0,0 +1,143 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <algorithm>
+
+#include "cyberdog_vision/reid_gallery_file.hpp"
+#include "cyberdog_vision/face_library_file.hpp"
+#include "cyberdog_common/cyberdog_log.hpp"
+
+namespace cyberdog_vision
+{
+
+static const char kReIDGalleryMagic[4] = {'X', 'M', 'R', 'G'};
+
+uint32_t ReIDModelTag(const std::string & model_file)
+{
+  struct stat st;
+  if (0 != stat(model_file.c_str(), &st)) {
+    WARN("Stat reid model %s fail. ", model_file.c_str());
+    return 0;
+  }
+  int64_t values[2] = {static_cast<int64_t>(st.st_size), static_cast<int64_t>(st.st_mtime)};
+  return Crc32(values, sizeof(values));
+}
+
+std::string ReIDGalleryPath(const std::string & name)
+{
+  if (name.empty() || name[0] == '.' || name.find('/') != std::string::npos) {
+    return std::string();
+  }
+  return std::string(kReIDGalleryDir) + name + ".bin";
+}
+
+int WriteReIDGallery(
+  const std::string & path, uint32_t model_tag,
+  const ReIDGalleryBase & gallery)
+{
+  if (access(kReIDGalleryDir, 0) != 0) {
+    umask(0);
+    mkdir(kReIDGalleryDir, 0755);
+  }
+
+  ReIDGalleryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kReIDGalleryMagic, sizeof(kReIDGalleryMagic));
+  header.version = kReIDGalleryVersion;
+  header.dim = gallery.Dim();
+  header.count = gallery.Size();
+  header.model_tag = model_tag;
+
+  size_t stamps_size = gallery.Size() * sizeof(int64_t);
+  size_t row_size = gallery.Dim() * sizeof(float);
+  std::vector<uint8_t> buf(sizeof(header) + stamps_size + gallery.Size() * row_size);
+  uint8_t * ptr = buf.data() + sizeof(header);
+  std::vector<float> row(gallery.Dim());
+  for (size_t i = 0; i < gallery.Size(); ++i) {
+    int64_t stamp = gallery.Stamp(i);
+    memcpy(ptr + i * sizeof(int64_t), &stamp, sizeof(int64_t));
+    gallery.Get(i, row.data());
+    memcpy(ptr + stamps_size + i * row_size, row.data(), row_size);
+  }
+  header.checksum = Crc32(buf.data() + sizeof(header), buf.size() - sizeof(header));
+  memcpy(buf.data(), &header, sizeof(header));
+
+  return WriteFileAtomic(path, buf);
+}
+
+int ReadReIDGallery(
+  const std::string & path, uint32_t model_tag, size_t capacity,
+  GalleryPolicy policy, std::unique_ptr<ReIDGalleryBase> & gallery)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  std::vector<uint8_t> buf;
+  uint8_t chunk[4096];
+  ssize_t n;
+  while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+  close(fd);
+
+  ReIDGalleryHeader header;
+  if (buf.size() < sizeof(header)) {
+    WARN("Reid gallery %s is truncated. ", path.c_str());
+    return -1;
+  }
+  memcpy(&header, buf.data(), sizeof(header));
+  size_t stamps_size = static_cast<size_t>(header.count) * sizeof(int64_t);
+  size_t row_size = static_cast<size_t>(header.dim) * sizeof(float);
+  if (0 != memcmp(header.magic, kReIDGalleryMagic, sizeof(kReIDGalleryMagic)) ||
+    header.version != kReIDGalleryVersion || header.dim == 0 ||
+    sizeof(header) + stamps_size + header.count * row_size != buf.size() ||
+    Crc32(buf.data() + sizeof(header), buf.size() - sizeof(header)) != header.checksum)
+  {
+    WARN("Reid gallery %s is broken. ", path.c_str());
+    return -1;
+  }
+  if (header.model_tag != model_tag) {
+    // Features of another engine can not be compared, the file is useless
+    INFO("Reid gallery %s is of another model, remove it. ", path.c_str());
+    unlink(path.c_str());
+    return -1;
+  }
+
+  const uint8_t * ptr = buf.data() + sizeof(header);
+  std::vector<std::pair<int64_t, size_t>> order(header.count);
+  for (size_t i = 0; i < header.count; ++i) {
+    memcpy(&order[i].first, ptr + i * sizeof(int64_t), sizeof(int64_t));
+    order[i].second = i;
+  }
+  std::sort(order.begin(), order.end());
+  gallery = MakeReIDGallery(header.dim, capacity, policy);
+  std::vector<float> row(header.dim);
+  for (auto & item : order) {
+    memcpy(row.data(), ptr + stamps_size + item.second * row_size, row_size);
+    gallery->Push(row.data(), item.first);
+  }
+  return 0;
+}
+
+}  // namespace cyberdog_vision
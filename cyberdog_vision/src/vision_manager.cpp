@@ -21,6 +21,7 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <chrono>
 
 #include "cyberdog_vision/vision_manager.hpp"
 #include "cyberdog_vision/semaphore_op.hpp"
@@ -31,7 +32,7 @@
 
 const int kKeypointsNum = 17;
 const char kModelPath[] = "/SDCARD/vision";
-const char kLibraryPath[] = "/home/mi/.faces/faceinfo.yaml";
+const uint64_t kFaceBodyMaxLagNs = 200000000ULL;
 namespace cyberdog_vision
 {
 
@@ -41,12 +42,12 @@ VisionManager::VisionManager()
   depend_manager_thread_(nullptr), body_det_thread_(nullptr),
   face_thread_(nullptr), focus_thread_(nullptr),
   gesture_thread_(nullptr), reid_thread_(nullptr),
-  keypoints_thread_(nullptr), body_ptr_(nullptr),
+  keypoints_thread_(nullptr), enroll_thread_(nullptr), body_ptr_(nullptr),
   face_ptr_(nullptr), focus_ptr_(nullptr),
   gesture_ptr_(nullptr), reid_ptr_(nullptr),
-  keypoints_ptr_(nullptr), shm_addr_(nullptr), buf_size_(6),
+  keypoints_ptr_(nullptr), shm_addr_(nullptr), frame_id_(0), buf_size_(6),
   open_face_(false), open_body_(false), open_gesture_(false),
-  open_keypoints_(false), open_reid_(false), open_focus_(false),
+  open_keypoints_(false), open_reid_(false), open_focus_(false), focus_fuse_(false),
   open_face_manager_(false), is_activate_(false), main_algo_deactivated_(false),
   depend_deactivated_(false), body_deactivated_(false),
   face_deactivated_(false), focus_deactivated_(false),
@@ -57,6 +58,64 @@ VisionManager::VisionManager()
   focus_complated_(false)
 {
   setvbuf(stdout, NULL, _IONBF, BUFSIZ);
+  body_results_.history.SetCapacity(buf_size_);
+
+  // Face quality gate thresholds
+  FaceQualityParams quality;
+  declare_parameter("face_quality.min_face_ratio", quality.min_face_ratio);
+  declare_parameter("face_quality.min_sharpness", quality.min_sharpness);
+  declare_parameter("face_quality.max_yaw", quality.max_yaw);
+  declare_parameter("face_quality.max_pitch", quality.max_pitch);
+  declare_parameter("face_quality.max_roll", quality.max_roll);
+  // Cosine a face needs against the library
+  declare_parameter("face_match.thres", kFaceMatchThres);
+
+  // Face enrollment stability window and thresholds
+  FaceEnrollParams enroll;
+  declare_parameter("face_enroll.window", static_cast<int>(enroll.window));
+  declare_parameter("face_enroll.pose_stable_thres", enroll.pose_stable_thres);
+  declare_parameter("face_enroll.yaw_legal_thres", enroll.yaw_legal_thres);
+  declare_parameter("face_enroll.pitch_legal_thres", enroll.pitch_legal_thres);
+  declare_parameter("face_enroll.row_legal_thres", enroll.row_legal_thres);
+  declare_parameter("face_enroll.area_stable_thres", enroll.area_stable_thres);
+  declare_parameter("face_enroll.area_legal_thres", enroll.area_legal_thres);
+
+  // Face emotion and age stay on by default, turning one off keeps its
+  // model unloaded and leaves the FaceT field at 0. Each track gets them
+  // once and again every refresh period
+  FaceTrackParams face_track;
+  declare_parameter("face_attr.emotion", true);
+  declare_parameter("face_attr.age", true);
+  declare_parameter("face_attr.refresh_sec", face_track.attr_refresh_ns / 1e9);
+
+  // Most bodies the reid extracts per frame
+  declare_parameter("reid.max_crops", 8);
+  // Unmatched frames before the reid looks past the motion gate, 0 disables
+  declare_parameter("reid.gate_misses", 5);
+  // Persons followed at once, each selection adds one until full
+  declare_parameter("reid.max_targets", 1);
+  // A lost person is searched every recover_interval frames for recover_sec
+  // before its gallery is dropped, only among new bodies if recover_new_only
+  declare_parameter("reid.recover_sec", 60.0);
+  declare_parameter("reid.recover_interval", 10);
+  declare_parameter("reid.recover_new_only", false);
+  // Features kept per person, a full gallery replaces the oldest (fifo) or
+  // one of the two most alike (diverse)
+  declare_parameter("reid.gallery_size", 15);
+  declare_parameter("reid.gallery_policy", std::string("diverse"));
+  // Gallery feature storage, fp32, fp16 or int8
+  declare_parameter("reid.gallery_precision", std::string(FeatPrecisionName(kFeatFp32)));
+  // Keep the gallery of the followed person across sessions under a name,
+  // it is searched for on the next start without a selection
+  declare_parameter("reid.gallery_store", false);
+  declare_parameter("reid.gallery_name", std::string("owner"));
+
+  // With body detection open, focus tracking takes the detections and only
+  // runs its siamese search when they do not settle the target
+  declare_parameter("focus.fuse", true);
+
+  // Face library feature storage, fp32, fp16 or int8
+  declare_parameter("face_library.precision", std::string(FeatPrecisionName(kFeatFp32)));
 
   // Create model object
   track_model_ = std::make_shared<CyberdogModelT>("auto_track");
@@ -244,14 +303,46 @@ void VisionManager::CreateObjectAI()
   }
 
   if (open_face_ || open_face_manager_) {
+    bool open_emotion = get_parameter("face_attr.emotion").as_bool();
+    bool open_age = get_parameter("face_attr.age").as_bool();
     face_ptr_ = std::make_shared<FaceRecognition>(
       kModelPath + std::string(
-        "/face_recognition"), true, true);
+        "/face_recognition"), open_emotion, open_age);
+    FaceTrackParams face_track;
+    face_track.attr_refresh_ns = get_parameter("face_attr.refresh_sec").as_double() * 1e9;
+    face_tracks_.SetParams(face_track);
+    FaceQualityParams quality;
+    quality.min_face_ratio = get_parameter("face_quality.min_face_ratio").as_double();
+    quality.min_sharpness = get_parameter("face_quality.min_sharpness").as_double();
+    quality.max_yaw = get_parameter("face_quality.max_yaw").as_double();
+    quality.max_pitch = get_parameter("face_quality.max_pitch").as_double();
+    quality.max_roll = get_parameter("face_quality.max_roll").as_double();
+    face_ptr_->SetQualityParams(quality);
+    face_ptr_->SetMatchThres(get_parameter("face_match.thres").as_double());
+
+    FaceEnrollParams enroll;
+    enroll.window = get_parameter("face_enroll.window").as_int();
+    enroll.pose_stable_thres = get_parameter("face_enroll.pose_stable_thres").as_double();
+    enroll.yaw_legal_thres = get_parameter("face_enroll.yaw_legal_thres").as_double();
+    enroll.pitch_legal_thres = get_parameter("face_enroll.pitch_legal_thres").as_double();
+    enroll.row_legal_thres = get_parameter("face_enroll.row_legal_thres").as_double();
+    enroll.area_stable_thres = get_parameter("face_enroll.area_stable_thres").as_double();
+    enroll.area_legal_thres = get_parameter("face_enroll.area_legal_thres").as_double();
+    FaceManager::getInstance()->setEnrollParams(enroll);
+
+    FeatPrecision precision;
+    std::string precision_name = get_parameter("face_library.precision").as_string();
+    if (ParseFeatPrecision(precision_name, precision)) {
+      FaceManager::getInstance()->setFeatPrecision(precision);
+    } else {
+      WARN("Unknown face library precision %s, keep fp32. ", precision_name.c_str());
+    }
   }
 
   if (open_focus_) {
     focus_ptr_ = std::make_shared<AutoTrack>(
       kModelPath + std::string("/auto_track"));
+    focus_fuse_ = open_body_ && get_parameter("focus.fuse").as_bool();
   }
 
   if (open_gesture_) {
@@ -264,6 +355,31 @@ void VisionManager::CreateObjectAI()
       std::make_shared<PersonReID>(
       kModelPath +
       std::string("/person_reid"));
+    reid_ptr_->SetMaxCrops(get_parameter("reid.max_crops").as_int());
+    reid_ptr_->SetGateMisses(get_parameter("reid.gate_misses").as_int());
+    reid_ptr_->SetMaxTargets(get_parameter("reid.max_targets").as_int());
+    reid_ptr_->SetRecovery(
+      get_parameter("reid.recover_sec").as_double(),
+      get_parameter("reid.recover_interval").as_int(),
+      get_parameter("reid.recover_new_only").as_bool());
+    GalleryPolicy gallery_policy = kGalleryDiverse;
+    std::string policy_name = get_parameter("reid.gallery_policy").as_string();
+    if (!ParseGalleryPolicy(policy_name, gallery_policy)) {
+      WARN("Unknown reid gallery policy %s, use diverse. ", policy_name.c_str());
+    }
+    FeatPrecision gallery_precision = kFeatFp32;
+    std::string precision_name = get_parameter("reid.gallery_precision").as_string();
+    if (!ParseFeatPrecision(precision_name, gallery_precision)) {
+      WARN("Unknown reid gallery precision %s, keep fp32. ", precision_name.c_str());
+    }
+    reid_ptr_->SetGallery(
+      get_parameter("reid.gallery_size").as_int(), gallery_policy, gallery_precision);
+    int person_id = -1;
+    if (get_parameter("reid.gallery_store").as_bool() &&
+      0 == reid_ptr_->LoadGallery(get_parameter("reid.gallery_name").as_string(), person_id))
+    {
+      INFO("Search stored person, person id: %d", person_id);
+    }
   }
 
   if (open_keypoints_) {
@@ -312,7 +428,7 @@ void VisionManager::CreateThread()
   if (!open_face_manager_) {
     main_manager_thread_ = std::make_shared<std::thread>(&VisionManager::MainAlgoManager, this);
   }
-  if (open_reid_ || open_gesture_ || open_keypoints_) {
+  if (open_reid_ || open_gesture_ || open_keypoints_ || (open_focus_ && focus_fuse_)) {
     depend_manager_thread_ = std::make_shared<std::thread>(&VisionManager::DependAlgoManager, this);
   }
   if (open_body_) {
@@ -333,6 +449,9 @@ void VisionManager::CreateThread()
   if (open_keypoints_) {
     keypoints_thread_ = std::make_shared<std::thread>(&VisionManager::KeypointsDet, this);
   }
+  if (open_face_ || open_face_manager_) {
+    enroll_thread_ = std::make_shared<std::thread>(&VisionManager::FaceEnrollProc, this);
+  }
 }
 
 void VisionManager::ImageProc()
@@ -351,6 +470,7 @@ void VisionManager::ImageProc()
     memcpy(&time, reinterpret_cast<char *>(shm_addr_), sizeof(uint64_t));
     simg.header.stamp.sec = time / 1000000000;
     simg.header.stamp.nanosec = time % 1000000000;
+    simg.frame_id = ++frame_id_;
     INFO("Received rgb image, ts: %.9d.%.9d", simg.header.stamp.sec, simg.header.stamp.nanosec);
     if (0 != SignalSem(sem_set_id_, 0)) {return;}
     if (0 != SignalSem(sem_set_id_, 1)) {return;}
@@ -360,8 +480,8 @@ void VisionManager::ImageProc()
       std::unique_lock<std::mutex> lk(global_img_buf_.mtx);
       global_img_buf_.img_buf.clear();
       global_img_buf_.img_buf.push_back(simg);
-      global_img_buf_.is_filled = true;
-      global_img_buf_.cond.notify_one();
+      global_img_buf_.seq++;
+      global_img_buf_.cond.notify_all();
       INFO("ImageProc: Notify main thread. ");
     }
   }
@@ -369,12 +489,17 @@ void VisionManager::ImageProc()
 
 void VisionManager::MainAlgoManager()
 {
+  uint64_t cursor;
+  {
+    std::unique_lock<std::mutex> lk(global_img_buf_.mtx);
+    cursor = global_img_buf_.seq;
+  }
   while (rclcpp::ok()) {
     {
       INFO("MainAlgoManager: Wait to activate main thread. ");
       std::unique_lock<std::mutex> lk(global_img_buf_.mtx);
-      global_img_buf_.cond.wait(lk, [this] {return global_img_buf_.is_filled;});
-      global_img_buf_.is_filled = false;
+      global_img_buf_.cond.wait(lk, [this, &cursor] {return global_img_buf_.seq != cursor;});
+      cursor = global_img_buf_.seq;
       INFO("MainAlgoManager: Activate main algo manager thread. ");
     }
     if (!is_activate_) {
@@ -388,6 +513,9 @@ void VisionManager::MainAlgoManager()
       if (!body_struct_.is_called) {
         body_complated_ = false;
         reid_complated_ = false;
+        if (focus_fuse_) {
+          focus_complated_ = false;
+        }
         gesture_complated_ = false;
         keypoints_complated_ = false;
         body_struct_.is_called = true;
@@ -404,7 +532,7 @@ void VisionManager::MainAlgoManager()
       }
     }
 
-    if (open_focus_) {
+    if (open_focus_ && !focus_fuse_) {
       std::unique_lock<std::mutex> lk_result(focus_struct_.mtx);
       if (!focus_struct_.is_called) {
         focus_complated_ = false;
@@ -491,6 +619,14 @@ void VisionManager::DependAlgoManager()
         keypoints_struct_.cond.notify_one();
       }
     }
+
+    if (open_focus_ && focus_fuse_) {
+      std::unique_lock<std::mutex> lk_result(focus_struct_.mtx);
+      if (!focus_struct_.is_called) {
+        focus_struct_.is_called = true;
+        focus_struct_.cond.notify_one();
+      }
+    }
     INFO("DependAlgoManager: end of depend thread. ");
   }
 }
@@ -553,12 +689,7 @@ void VisionManager::BodyDet()
     {
       std::unique_lock<std::mutex> lk_body(body_results_.mtx);
       if (-1 != body_ptr_->Detect(stamped_img.img, infos)) {
-        if (body_results_.body_infos.size() >= buf_size_) {
-          body_results_.body_infos.erase(body_results_.body_infos.begin());
-        }
-        body_results_.body_infos.push_back(infos);
-        body_results_.detection_img.img = stamped_img.img.clone();
-        body_results_.detection_img.header = stamped_img.header;
+        body_results_.history.Push(stamped_img, infos);
         body_results_.is_filled = true;
         body_results_.cond.notify_one();
         INFO("BodyDet: Body thread notify depend thread. ");
@@ -617,8 +748,12 @@ void Convert(
     face.yaw = from[i].poses[0];
     face.pitch = from[i].poses[1];
     face.row = from[i].poses[2];
-    face.age = from[i].ages[0];
-    face.emotion = from[i].emotions[0];
+    if (!from[i].ages.empty()) {
+      face.age = from[i].ages[0];
+    }
+    if (!from[i].emotions.empty()) {
+      face.emotion = from[i].emotions[0];
+    }
     to.infos.push_back(face);
   }
 }
@@ -646,10 +781,66 @@ void VisionManager::FaceRecognize()
       stamped_img = global_img_buf_.img_buf.back();
     }
 
-    // Face recognition and get result
+    // Face recognition with the library version of current frame, cached
+    // identities are dropped once the library changes
+    std::shared_ptr<const FaceGallery> face_library = FaceManager::getInstance()->getSnapshot();
+    if (face_library != face_tracks_library_) {
+      face_tracks_.Clear();
+      face_tracks_library_ = face_library;
+    }
+
+    // Bodies of the same frame, or the previous one while body thread runs
+    BodyFrameInfo bodies;
+    uint64_t stamp_ns = StampToNs(stamped_img.header.stamp);
+    if (open_body_) {
+      std::unique_lock<std::mutex> lk_body(body_results_.mtx);
+      const DetectionFrame * det = body_results_.history.FindByStamp(stamped_img.header.stamp);
+      if (det == nullptr && !body_results_.history.Empty()) {
+        det = &body_results_.history.Latest();
+        if (stamp_ns < det->stamp_ns || stamp_ns - det->stamp_ns > kFaceBodyMaxLagNs) {
+          det = nullptr;
+        }
+      }
+      if (det != nullptr) {
+        bodies = det->infos;
+      }
+    }
+
     std::vector<MatchFaceInfo> result;
-    if (0 != face_ptr_->GetRecognitionResult(stamped_img.img, face_library_, result)) {
-      WARN("FaceRecognize: Face recognition fail. ");
+    if (!face_tracks_.NeedDetect(stamp_ns, bodies)) {
+      face_tracks_.Predict(bodies, result);
+      INFO("FaceRecognize: Reuse %zu cached faces. ", result.size());
+    } else {
+      std::vector<EntryFaceInfo> entries;
+      std::vector<bool> need_match;
+      if (0 != face_ptr_->GetFaceInfo(stamped_img.img, entries)) {
+        WARN("FaceRecognize: Face recognition fail. ");
+      }
+      face_tracks_.Associate(stamp_ns, entries, bodies, result, need_match);
+      std::vector<bool> usable(entries.size(), true);
+      for (size_t i = 0; i < entries.size(); ++i) {
+        // Poor faces keep the identity and attributes of their track
+        if (!face_ptr_->CheckQuality(stamped_img.img, entries[i])) {
+          usable[i] = false;
+          need_match[i] = false;
+        } else if (need_match[i]) {
+          face_ptr_->MatchFace(entries[i], *face_library, result[i]);
+        }
+      }
+      if (face_ptr_->HasAttributes() && face_tracks_.NeedAttributes(stamp_ns, usable)) {
+        std::vector<EntryFaceInfo> attrs;
+        if (0 != face_ptr_->GetFaceAttributes(stamped_img.img, entries, usable, attrs)) {
+          WARN("FaceRecognize: Face attributes fail. ");
+        }
+        face_tracks_.ApplyAttributes(stamp_ns, attrs, usable, result);
+      }
+      face_tracks_.Commit(stamp_ns, result, need_match);
+      FaceQualityStats stats = face_ptr_->GetQualityStats();
+      INFO(
+        "FaceRecognize: Quality gate checked %lu, skipped small %lu, blur %lu, pose %lu, "
+        "attr crops %lu, saved match %.3f ms, attr %.3f ms", stats.checked, stats.skipped_small,
+        stats.skipped_blur, stats.skipped_pose, stats.skipped_attr, stats.match_saved_ms,
+        stats.attr_saved_ms);
     }
 
     // Storage face recognition result
@@ -693,16 +884,25 @@ void VisionManager::FocusTrack()
       return;
     }
 
-    // Get image to proc
+    // Get image to proc, fused tracking takes the detected frame
     StampedImage stamped_img;
-    {
+    std::vector<InferBbox> body_bboxes;
+    if (focus_fuse_) {
+      std::unique_lock<std::mutex> lk_body(body_results_.mtx);
+      const DetectionFrame & det = body_results_.history.Latest();
+      stamped_img = det.frame;
+      body_bboxes = BodyConvert(det.infos);
+    } else {
       std::unique_lock<std::mutex> lk(global_img_buf_.mtx);
       stamped_img = global_img_buf_.img_buf.back();
     }
 
     // Focus track and get result
     cv::Rect track_res = cv::Rect(0, 0, 0, 0);
-    if (!focus_ptr_->Track(stamped_img.img, track_res)) {
+    bool is_tracked = focus_fuse_ ?
+      focus_ptr_->Track(stamped_img.img, body_bboxes, track_res) :
+      focus_ptr_->Track(stamped_img.img, track_res);
+    if (!is_tracked) {
       WARN("FocusTrack: Auto track fail of crunt frame. ");
     }
     if (focus_ptr_->GetLostStatus()) {
@@ -751,11 +951,20 @@ double GetIOU(const HumanBodyInfo & b1, const sensor_msgs::msg::RegionOfInterest
          b2.width * b2.height - w * h);
 }
 
+void Convert(const std::vector<ReIDMatch> & from, BodyInfoT & to)
+{
+  for (size_t i = 0; i < from.size(); ++i) {
+    if (from[i].body_index < to.infos.size()) {
+      to.infos[from[i].body_index].reid = std::to_string(from[i].id);
+    }
+  }
+}
+
 void VisionManager::ReIDProc()
 {
   while (rclcpp::ok()) {
-    int person_id = -1;
     cv::Rect tracked_bbox = cv::Rect(0, 0, 0, 0);
+    std::vector<ReIDMatch> matches;
     {
       INFO("ReIDProc: Wait to activate reid thread. ");
       std::unique_lock<std::mutex> lk_reid(reid_struct_.mtx);
@@ -770,25 +979,31 @@ void VisionManager::ReIDProc()
     }
 
     // ReID and get result
-    cv::Mat img_show;
     std_msgs::msg::Header img_header;
     {
       INFO("ReIDProc: Waiting for mutex to reid. ");
       std::unique_lock<std::mutex> lk_body(body_results_.mtx);
-      std::vector<InferBbox> body_bboxes = BodyConvert(body_results_.body_infos.back());
-      img_show = body_results_.detection_img.img.clone();
-      img_header = body_results_.detection_img.header;
-      if (-1 !=
-        reid_ptr_->GetReIDInfo(
-          body_results_.detection_img.img, body_bboxes, person_id, tracked_bbox) &&
-        -1 != person_id)
-      {
-        INFO(
-          "ReIDProc: Reid result, person id: %d, bbox: %d, %d, %d, %d", person_id, tracked_bbox.x,
-          tracked_bbox.y, tracked_bbox.width, tracked_bbox.height);
+      const DetectionFrame & det = body_results_.history.Latest();
+      std::vector<InferBbox> body_bboxes = BodyConvert(det.infos);
+      img_header = det.frame.header;
+      // The first target followed goes to the track result, every matched
+      // target tags its body with the person id
+      int primary_id = reid_ptr_->GetPrimaryId();
+      if (-1 != reid_ptr_->GetReIDInfos(det.frame.img, body_bboxes, matches)) {
+        for (auto & match : matches) {
+          INFO(
+            "ReIDProc: Reid result, person id: %d, bbox: %d, %d, %d, %d", match.id, match.box.x,
+            match.box.y, match.box.width, match.box.height);
+          if (match.id == primary_id) {
+            tracked_bbox = match.box;
+          }
+        }
       }
       if (reid_ptr_->GetLostStatus()) {
         processing_status_.status = TrackingStatusT::STATUS_SELECTING;
+      } else if (!matches.empty()) {
+        // Lost targets found again resume tracking on their own
+        processing_status_.status = TrackingStatusT::STATUS_TRACKING;
       }
     }
 
@@ -799,6 +1014,7 @@ void VisionManager::ReIDProc()
       std::unique_lock<std::mutex> lk_result(result_mtx_, std::adopt_lock);
       reid_complated_ = true;
       Convert(img_header, tracked_bbox, algo_result_.track_res);
+      Convert(matches, algo_result_.body_info);
       SetThreadState("ReIDProc", algo_proc_.process_complated);
       INFO("ReIDProc: reid thread process_complated: %d", algo_proc_.process_complated);
       if (algo_proc_.process_complated) {
@@ -838,8 +1054,9 @@ void VisionManager::GestureRecognize()
     std::vector<GestureInfo> infos;
     {
       std::unique_lock<std::mutex> lk_body(body_results_.mtx);
-      std::vector<InferBbox> body_bboxes = BodyConvert(body_results_.body_infos.back());
-      if (-1 != gesture_ptr_->GetGestureInfo(body_results_.detection_img.img, body_bboxes, infos)) {
+      const DetectionFrame & det = body_results_.history.Latest();
+      std::vector<InferBbox> body_bboxes = BodyConvert(det.infos);
+      if (-1 != gesture_ptr_->GetGestureInfo(det.frame.img, body_bboxes, infos)) {
         is_success = true;
       }
     }
@@ -897,10 +1114,9 @@ void VisionManager::KeypointsDet()
     std::vector<std::vector<cv::Point2f>> bodies_keypoints;
     {
       std::unique_lock<std::mutex> lk_body(body_results_.mtx);
-      std::vector<InferBbox> body_bboxes = BodyConvert(body_results_.body_infos.back());
-      keypoints_ptr_->GetKeypointsInfo(
-        body_results_.detection_img.img, body_bboxes,
-        bodies_keypoints);
+      const DetectionFrame & det = body_results_.history.Latest();
+      std::vector<InferBbox> body_bboxes = BodyConvert(det.infos);
+      keypoints_ptr_->GetKeypointsInfo(det.frame.img, body_bboxes, bodies_keypoints);
     }
 
     // Storage keypoints detection result
@@ -921,62 +1137,61 @@ void VisionManager::KeypointsDet()
   }
 }
 
-int VisionManager::LoadFaceLibrary(std::map<std::string, std::vector<float>> & library)
+int VisionManager::GetMatchBody(
+  const sensor_msgs::msg::RegionOfInterest & roi,
+  const builtin_interfaces::msg::Time & stamp)
 {
-  cv::FileStorage fs(std::string(kLibraryPath), cv::FileStorage::READ);
-  if (!fs.isOpened()) {
-    ERROR("Open the face library file fail! ");
+  if (body_results_.history.Empty()) {
+    WARN("No body detection to match. ");
     return -1;
   }
 
-  library.erase(library.begin(), library.end());
-  cv::FileNode node = fs["UserFaceInfo"];
-  cv::FileNodeIterator it = node.begin();
-  for (; it != node.end(); ++it) {
-    std::string name = (string)(*it)["name"];
-    cv::FileNode feat = (*it)["feature"];
-    cv::FileNodeIterator jt = feat.begin();
-    std::vector<float> face_feat;
-    for (; jt != feat.end(); ++jt) {
-      face_feat.push_back(static_cast<float>(*jt));
+  // Prefer the exact frame displayed by app, otherwise search from newest to oldest
+  std::vector<const DetectionFrame *> candidates;
+  const DetectionFrame * stamped_frame = body_results_.history.FindByStamp(stamp);
+  if (stamped_frame != nullptr) {
+    candidates.push_back(stamped_frame);
+  } else {
+    WARN("No detection of stamp %d.%d, search in history. ", stamp.sec, stamp.nanosec);
+    for (size_t i = 0; i < body_results_.history.Size(); ++i) {
+      candidates.push_back(&body_results_.history.At(i));
     }
-    library.insert(std::pair<std::string, std::vector<float>>(name, face_feat));
   }
 
-  return 0;
-}
-
-int VisionManager::GetMatchBody(const sensor_msgs::msg::RegionOfInterest & roi)
-{
-  cv::Mat track_img;
+  const DetectionFrame * match_frame = nullptr;
   cv::Rect track_rect;
-  bool is_found = false;
-  for (size_t i = body_results_.body_infos.size() - 1; i > 0 && !is_found; --i) {
+  for (size_t i = 0; i < candidates.size() && match_frame == nullptr; ++i) {
     double max_score = 0;
-    for (size_t j = 0; j < body_results_.body_infos[i].size(); ++j) {
-      double score = GetIOU(body_results_.body_infos[i][j], roi);
+    const BodyFrameInfo & infos = candidates[i]->infos;
+    for (size_t j = 0; j < infos.size(); ++j) {
+      double score = GetIOU(infos[j], roi);
       if (score > max_score && score > 0.5) {
         max_score = score;
-        track_rect = cv::Rect(
-          body_results_.body_infos[i][j].left,
-          body_results_.body_infos[i][j].top,
-          body_results_.body_infos[i][j].width,
-          body_results_.body_infos[i][j].height);
+        track_rect = cv::Rect(infos[j].left, infos[j].top, infos[j].width, infos[j].height);
       }
     }
     if (max_score > 0.5) {
-      is_found = true;
-      track_img = body_results_.detection_img.img;
+      match_frame = candidates[i];
     }
   }
-  if (is_found) {
-    std::vector<float> reid_feat;
-    if (0 != reid_ptr_->SetTracker(track_img, track_rect, reid_feat)) {
-      WARN("Set reid tracker fail. ");
+  if (match_frame == nullptr) {
+    WARN("Can not find match body. ");
+    return -1;
+  }
+
+  INFO(
+    "Match body in frame %lu, stamp: %d.%d", match_frame->frame.frame_id,
+    match_frame->frame.header.stamp.sec, match_frame->frame.header.stamp.nanosec);
+  std::vector<float> reid_feat;
+  if (reid_ptr_->GetMaxTargets() > 1) {
+    int person_id = -1;
+    if (0 != reid_ptr_->AddTracker(match_frame->frame.img, track_rect, person_id, reid_feat)) {
+      WARN("Add reid tracker fail. ");
       return -1;
     }
-  } else {
-    WARN("Can not find match body. ");
+    INFO("Add reid target, person id: %d", person_id);
+  } else if (0 != reid_ptr_->SetTracker(match_frame->frame.img, track_rect, reid_feat)) {
+    WARN("Set reid tracker fail. ");
     return -1;
   }
   return 0;
@@ -989,7 +1204,8 @@ void VisionManager::SetAlgoState(const AlgoListT & algo_list, const bool & value
     case AlgoListT::ALGO_FACE:
       open_face_ = value;
       if (value) {
-        LoadFaceLibrary(face_library_);
+        // Load face library before recognition starts
+        FaceManager::getInstance();
       }
       break;
     case AlgoListT::ALGO_BODY:
@@ -1010,7 +1226,7 @@ void VisionManager::SetAlgoState(const AlgoListT & algo_list, const bool & value
     case AlgoListT::FACE_MANAGER:
       open_face_manager_ = value;
       if (value) {
-        LoadFaceLibrary(face_library_);
+        FaceManager::getInstance();
       }
     default:
       break;
@@ -1028,7 +1244,7 @@ void VisionManager::TrackingService(
 
   if (open_reid_) {
     std::unique_lock<std::mutex> lk(body_results_.mtx);
-    if (0 != GetMatchBody(req->roi)) {
+    if (0 != GetMatchBody(req->roi, req->header.stamp)) {
       res->success = false;
     } else {
       res->success = true;
@@ -1037,8 +1253,24 @@ void VisionManager::TrackingService(
   }
 
   if (open_focus_) {
+    // Fused tracking runs on the detected frames, start it on one of them
     StampedImage stamped_img;
-    {
+    bool is_seeded = false;
+    if (focus_fuse_) {
+      std::unique_lock<std::mutex> lk(body_results_.mtx);
+      if (!body_results_.history.Empty()) {
+        const DetectionFrame * frame = body_results_.history.FindByStamp(req->header.stamp);
+        if (frame == nullptr) {
+          WARN(
+            "No detection of stamp %d.%d, set focus on the latest. ", req->header.stamp.sec,
+            req->header.stamp.nanosec);
+          frame = &body_results_.history.Latest();
+        }
+        stamped_img = frame->frame;
+        is_seeded = true;
+      }
+    }
+    if (!is_seeded) {
       std::unique_lock<std::mutex> lk(global_img_buf_.mtx);
       stamped_img = global_img_buf_.img_buf.back();
     }
@@ -1132,16 +1364,12 @@ void VisionManager::FaceManagerService(
       if (request->username.length() == 0) {
         response->result = -1;
       } else {
-        FaceManager::getInstance()->addFaceIDCacheInfo(request->username, request->ishost);
-        face_detect_ = true;
-        std::thread faceDet = std::thread(&VisionManager::FaceDetProc, this, request->username);
-        faceDet.detach();
-        response->result = 0;
+        response->result = StartEnroll(request->username, request->ishost);
       }
       break;
     case FaceManagerT::Request::CANCLE_ADD_FACE:
       INFO("cancelAddFace");
-      face_detect_ = false;
+      CancelEnroll();
       response->result = FaceManager::getInstance()->cancelAddFace();
       break;
     case FaceManagerT::Request::CONFIRM_LAST_FACE:
@@ -1197,26 +1425,115 @@ void VisionManager::publishFaceResult(
   face_result_pub_->publish(std::move(face_result_msg));
 }
 
+int VisionManager::StartEnroll(const std::string & face_name, bool is_host)
+{
+  if (enroll_thread_ == nullptr) {
+    ERROR("Face enrollment is not available, open face algo first. ");
+    return -1;
+  }
+
+  // A new request replaces the running one, the worker resets the cache
+  // once the running one has left
+  {
+    std::unique_lock<std::mutex> lk(enroll_.mtx);
+    enroll_.name = face_name;
+    enroll_.is_host = is_host;
+    enroll_.has_request = true;
+    enroll_.is_cancel = true;
+    enroll_.cond.notify_all();
+  }
+  std::unique_lock<std::mutex> lk_img(global_img_buf_.mtx);
+  global_img_buf_.cond.notify_all();
+  return 0;
+}
+
+void VisionManager::CancelEnroll()
+{
+  {
+    std::unique_lock<std::mutex> lk(enroll_.mtx);
+    enroll_.has_request = false;
+    enroll_.is_cancel = true;
+  }
+  {
+    std::unique_lock<std::mutex> lk_img(global_img_buf_.mtx);
+    global_img_buf_.cond.notify_all();
+  }
+
+  // The cache is cleared by the caller, nothing may add to it after this
+  std::unique_lock<std::mutex> lk(enroll_.mtx);
+  enroll_.cond.wait(lk, [this] {return !enroll_.is_running;});
+}
+
+void VisionManager::FaceEnrollProc()
+{
+  while (true) {
+    std::string face_name;
+    bool is_host;
+    {
+      INFO("FaceEnrollProc: Wait for enrollment request. ");
+      std::unique_lock<std::mutex> lk(enroll_.mtx);
+      enroll_.cond.wait(lk, [this] {return enroll_.has_request || enroll_.is_exit;});
+      if (enroll_.is_exit) {
+        INFO("FaceEnrollProc: Exit face enrollment thread. ");
+        return;
+      }
+      enroll_.has_request = false;
+      enroll_.is_cancel = false;
+      enroll_.is_running = true;
+      face_name = enroll_.name;
+      is_host = enroll_.is_host;
+    }
+
+    // Reset here, the last enrollment has left and cannot push any more
+    FaceManager::getInstance()->addFaceIDCacheInfo(face_name, is_host);
+    FaceDetProc(face_name);
+    {
+      std::unique_lock<std::mutex> lk(enroll_.mtx);
+      enroll_.is_running = false;
+      enroll_.cond.notify_all();
+    }
+  }
+}
+
 void VisionManager::FaceDetProc(std::string face_name)
 {
-  std::map<std::string, std::vector<float>> endlib_feats;
-  std::vector<MatchFaceInfo> match_info;
+  std::shared_ptr<const FaceGallery> endlib_feats;
+  MatchFaceInfo match_info;
   cv::Mat mat_tmp;
   bool get_face_timeout = true;
   std::string checkFacePose_Msg;
   int checkFacePose_ret;
-  endlib_feats = FaceManager::getInstance()->getFeatures();
+  endlib_feats = FaceManager::getInstance()->getSnapshot();
   std::time_t cur_time = std::time(NULL);
+  uint64_t cursor;
+  {
+    std::unique_lock<std::mutex> lk_img(global_img_buf_.mtx);
+    cursor = global_img_buf_.seq;
+  }
 
-  while (face_ptr_ != nullptr && std::difftime(std::time(NULL), cur_time) < 40 && face_detect_) {
+  while (face_ptr_ != nullptr && std::difftime(std::time(NULL), cur_time) < 40 &&
+    !enroll_.is_cancel && !enroll_.is_exit)
+  {
+    get_face_timeout = false;
+    {
+      // Take every new frame without consuming it for other readers
+      std::unique_lock<std::mutex> lk_img(global_img_buf_.mtx);
+      bool is_woken = global_img_buf_.cond.wait_for(
+        lk_img, std::chrono::seconds(1), [this, &cursor] {
+          return global_img_buf_.seq != cursor || enroll_.is_cancel || enroll_.is_exit;
+        });
+      get_face_timeout = true;
+      if (!is_woken || enroll_.is_cancel || enroll_.is_exit ||
+        global_img_buf_.img_buf.empty())
+      {
+        continue;
+      }
+      cursor = global_img_buf_.seq;
+      mat_tmp = global_img_buf_.img_buf.back().img;
+    }
     get_face_timeout = false;
-    std::unique_lock<std::mutex> lk_img(global_img_buf_.mtx);
-    global_img_buf_.cond.wait(lk_img, [this] {return global_img_buf_.is_filled;});
-    global_img_buf_.is_filled = false;
 
     std::vector<EntryFaceInfo> faces_info;
-    mat_tmp = global_img_buf_.img_buf[0].img.clone();
-
     face_ptr_->GetFaceInfo(mat_tmp, faces_info);
 #if 0
     // debug - visualization
@@ -1232,17 +1549,18 @@ void VisionManager::FaceDetProc(std::string face_name)
     cv::imshow("face", mat_tmp);
     cv::waitKey(10);
 #endif
+    FaceManager::getInstance()->offerFaceTemplate(faces_info);
     checkFacePose_ret = FaceManager::getInstance()->checkFacePose(faces_info, checkFacePose_Msg);
     if (checkFacePose_ret == 0) {
-      /*check if face feature already in endlib_feats*/
-      face_ptr_->GetRecognitionResult(mat_tmp, endlib_feats, match_info);
-      if (match_info.size() > 0 && match_info[0].match_score > 0.65) {
+      /*check if face feature already in endlib_feats, the pose check leaves one face*/
+      face_ptr_->MatchFace(faces_info[0], *endlib_feats, match_info);
+      if (!match_info.face_id.empty()) {
         checkFacePose_ret = 17;
-        face_name = match_info[0].face_id;
+        face_name = match_info.face_id;
         checkFacePose_Msg = "face already in endlib";
         ERROR(
           "%s face already in endlib current score:%f",
-          face_name.c_str(), match_info[0].match_score);
+          face_name.c_str(), match_info.match_score);
       } else {
         FaceManager::getInstance()->addFaceFeatureCacheInfo(faces_info);
       }
@@ -1255,7 +1573,7 @@ void VisionManager::FaceDetProc(std::string face_name)
   }
 
   /*it time out publish error*/
-  if (face_ptr_ != nullptr && get_face_timeout && face_detect_) {
+  if (face_ptr_ != nullptr && get_face_timeout && !enroll_.is_cancel && !enroll_.is_exit) {
     checkFacePose_Msg = "timeout";
     publishFaceResult(3, checkFacePose_Msg);
   }
@@ -1337,6 +1655,9 @@ void VisionManager::ResetAlgo()
     focus_ptr_->ResetTracker();
   }
   if (open_reid_) {
+    if (get_parameter("reid.gallery_store").as_bool()) {
+      reid_ptr_->SaveGallery(get_parameter("reid.gallery_name").as_string());
+    }
     reid_ptr_->ResetTracker();
   }
   open_face_ = false;
@@ -1345,6 +1666,7 @@ void VisionManager::ResetAlgo()
   open_keypoints_ = false;
   open_reid_ = false;
   open_focus_ = false;
+  focus_fuse_ = false;
   open_face_manager_ = false;
   main_algo_deactivated_ = false;
   depend_deactivated_ = false;
@@ -1369,11 +1691,10 @@ void VisionManager::ResetAlgo()
   {
     std::unique_lock<std::mutex> lk_body(body_results_.mtx);
     body_results_.is_filled = false;
+    body_results_.history.Clear();
   }
-  {
-    std::unique_lock<std::mutex> lk(global_img_buf_.mtx);
-    global_img_buf_.is_filled = false;
-  }
+  face_tracks_.Clear();
+  face_tracks_library_.reset();
   {
     std::unique_lock<std::mutex> lk_proc(algo_proc_.mtx);
     algo_proc_.process_complated = false;
@@ -1451,7 +1772,7 @@ void VisionManager::DestoryThread()
     INFO("body_det_thread_ joined. ");
   }
 
-  if (open_reid_ || open_gesture_ || open_keypoints_) {
+  if (open_reid_ || open_gesture_ || open_keypoints_ || (open_focus_ && focus_fuse_)) {
     {
       std::unique_lock<std::mutex> lk_proc(algo_proc_.mtx);
       algo_proc_.process_complated = true;
@@ -1473,16 +1794,31 @@ void VisionManager::DestoryThread()
     }
   }
 
+  if (enroll_thread_ != nullptr && enroll_thread_->joinable()) {
+    {
+      std::unique_lock<std::mutex> lk(enroll_.mtx);
+      enroll_.is_exit = true;
+      enroll_.cond.notify_all();
+    }
+    {
+      std::unique_lock<std::mutex> lk_img(global_img_buf_.mtx);
+      global_img_buf_.cond.notify_all();
+    }
+    enroll_thread_->join();
+    enroll_thread_.reset();
+    enroll_.is_exit = false;
+    INFO("enroll_thread_ joined. ");
+  }
+
   if (!open_face_manager_ && main_manager_thread_->joinable()) {
     if (!main_algo_deactivated_) {
       std::lock(global_img_buf_.mtx, algo_proc_.mtx);
       std::unique_lock<std::mutex> lk_img(global_img_buf_.mtx, std::adopt_lock);
       std::unique_lock<std::mutex> lk_proc(algo_proc_.mtx, std::adopt_lock);
-      if (!global_img_buf_.is_filled) {
-        global_img_buf_.is_filled = true;
-        global_img_buf_.cond.notify_one();
-        INFO("Destory notify main thread. ");
-      }
+      // Wake without a new frame, the main thread checks activation first
+      global_img_buf_.seq++;
+      global_img_buf_.cond.notify_all();
+      INFO("Destory notify main thread. ");
       if (!algo_proc_.process_complated) {
         algo_proc_.process_complated = true;
         algo_proc_.cond.notify_one();
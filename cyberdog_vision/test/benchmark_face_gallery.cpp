@@ -0,0 +1,156 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cyberdog_vision/face_gallery.hpp"
+
+// Query latency of the face gallery from 10 to 10,000 identities against
+// the per identity map it replaced, in microseconds per query
+namespace cyberdog_vision
+{
+
+const size_t kTemplates = 3;
+
+static std::vector<float> RandomFeat(std::mt19937 & rng, size_t dim)
+{
+  std::normal_distribution<float> dist(0.f, 1.f);
+  std::vector<float> feat(dim);
+  for (auto & value : feat) {
+    value = dist(rng);
+  }
+  L2Normalize(feat.data(), dim);
+  return feat;
+}
+
+// Identities with a few noisy templates around a center, loaded in bulk
+static void FillGallery(
+  std::mt19937 & rng, size_t count, size_t dim, FaceGallery & gallery,
+  std::map<std::string, std::vector<float>> & library)
+{
+  std::normal_distribution<float> noise(0.f, 0.02f);
+  size_t stride = AlignedStride(dim);
+  AlignedFloats rows(count * stride, 0.f);
+  AlignedFloats templates(count * kMaxFaceTemplates * stride, 0.f);
+  std::vector<float> weights(count * kMaxFaceTemplates, 0.f);
+  std::vector<uint8_t> nums(count, kTemplates);
+  std::vector<std::string> names(count);
+  std::vector<uint8_t> hosts(count, 0);
+  for (size_t i = 0; i < count; ++i) {
+    std::vector<float> center = RandomFeat(rng, dim);
+    float * row = &rows[i * stride];
+    for (size_t t = 0; t < kTemplates; ++t) {
+      float * tmpl = &templates[(i * kMaxFaceTemplates + t) * stride];
+      for (size_t d = 0; d < dim; ++d) {
+        tmpl[d] = center[d] + noise(rng);
+      }
+      L2Normalize(tmpl, dim);
+      for (size_t d = 0; d < dim; ++d) {
+        row[d] += tmpl[d];
+      }
+      weights[i * kMaxFaceTemplates + t] = 1.f;
+    }
+    L2Normalize(row, dim);
+    names[i] = "face_" + std::to_string(i);
+    library[names[i]] = std::vector<float>(row, row + dim);
+  }
+  gallery.Assign(dim, rows.data(), templates.data(), weights.data(), nums, names, hosts);
+}
+
+// Best cosine over the map, as the sdk matching walked it every frame
+static float MapBest(
+  const std::map<std::string, std::vector<float>> & library,
+  const std::vector<float> & feat)
+{
+  float best = -1.f;
+  for (auto & face : library) {
+    float ab = 0.f, aa = 0.f, bb = 0.f;
+    for (size_t d = 0; d < feat.size(); ++d) {
+      ab += feat[d] * face.second[d];
+      aa += feat[d] * feat[d];
+      bb += face.second[d] * face.second[d];
+    }
+    best = std::max(best, ab / sqrtf(aa * bb));
+  }
+  return best;
+}
+
+template<typename Func>
+static double UsPerCall(int calls, Func func)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; ++i) {
+    func(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() / calls;
+}
+
+static void Bench(size_t count, size_t dim, std::mt19937 & rng)
+{
+  FaceGallery gallery;
+  std::map<std::string, std::vector<float>> library;
+  FillGallery(rng, count, dim, gallery, library);
+  gallery.BuildIndex();
+
+  std::vector<std::vector<float>> probes;
+  for (int i = 0; i < 32; ++i) {
+    probes.push_back(RandomFeat(rng, dim));
+  }
+  int calls = static_cast<int>(std::max<size_t>(20, 200000 / count));
+  std::vector<GalleryMatch> matches;
+  volatile float sink = 0.f;
+
+  double map_us = UsPerCall(calls, [&](int i) {sink = sink + MapBest(library, probes[i % 32]);});
+  double exact1_us = UsPerCall(
+    calls, [&](int i) {
+      gallery.QueryExact(probes[i % 32], 1, matches);
+      sink = sink + matches[0].score;
+    });
+  double exact5_us = UsPerCall(
+    calls, [&](int i) {
+      gallery.QueryExact(probes[i % 32], 5, matches);
+      sink = sink + matches[0].score;
+    });
+  double query5_us = UsPerCall(
+    calls, [&](int i) {
+      gallery.Query(probes[i % 32], 5, matches);
+      sink = sink + matches[0].score;
+    });
+  printf(
+    "%6zu | map %9.2f | exact k1 %9.2f k5 %9.2f | query k5 %9.2f%s | speedup %5.1fx\n",
+    count, map_us, exact1_us, exact5_us, query5_us, gallery.Index().Empty() ? "" : " (ivf)",
+    map_us / exact1_us);
+}
+
+}  // namespace cyberdog_vision
+
+int main(int argc, char ** argv)
+{
+  size_t dim = argc > 1 ? strtoul(argv[1], nullptr, 10) : 512;
+  std::mt19937 rng(31);
+  printf("dim %zu, us per query\n", dim);
+  for (size_t count : {10, 100, 1000, 10000}) {
+    cyberdog_vision::Bench(count, dim, rng);
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "cyberdog_vision/face_gallery.hpp"
+
+// Recall and latency of the ivf query against exact search over gallery
+// sizes around kFaceIndexMinSize, to place the crossover. Probes are noisy
+// copies of enrolled faces, recall is the share whose best identity
+// matches the exact search.
+namespace cyberdog_vision
+{
+
+static std::vector<float> RandomFeat(std::mt19937 & rng, size_t dim)
+{
+  std::normal_distribution<float> dist(0.f, 1.f);
+  std::vector<float> feat(dim);
+  for (auto & value : feat) {
+    value = dist(rng);
+  }
+  L2Normalize(feat.data(), dim);
+  return feat;
+}
+
+static std::vector<float> Jitter(
+  std::mt19937 & rng, const std::vector<float> & feat, float sigma)
+{
+  std::normal_distribution<float> noise(0.f, sigma);
+  std::vector<float> out(feat);
+  for (auto & value : out) {
+    value += noise(rng);
+  }
+  L2Normalize(out.data(), out.size());
+  return out;
+}
+
+template<typename Func>
+static double UsPerCall(int calls, Func func)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; ++i) {
+    func(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() / calls;
+}
+
+// Identities spread over a few hundred loose groups, closer to real face
+// features than a uniform sphere
+static void Bench(size_t count, size_t dim, std::mt19937 & rng)
+{
+  std::vector<std::vector<float>> groups;
+  for (int i = 0; i < 256; ++i) {
+    groups.push_back(RandomFeat(rng, dim));
+  }
+  FaceGallery gallery;
+  std::vector<std::vector<float>> faces;
+  for (size_t i = 0; i < count; ++i) {
+    faces.push_back(Jitter(rng, groups[i % groups.size()], 0.06f));
+    gallery.Add("face_" + std::to_string(i), faces.back(), false);
+  }
+
+  // Train at any size, below kFaceIndexMinSize the gallery would not
+  size_t stride = gallery.Stride();
+  AlignedFloats rows(count * stride);
+  for (size_t i = 0; i < count; ++i) {
+    gallery.GetFeature(i, &rows[i * stride]);
+  }
+  FaceIndex index;
+  size_t nlist = static_cast<size_t>(sqrtf(static_cast<float>(count)));
+  double train_ms = UsPerCall(
+    1, [&](int) {index.Train(rows.data(), count, dim, nlist);}) / 1000.;
+  gallery.SetIndex(index);
+
+  std::vector<std::vector<float>> probes;
+  for (int i = 0; i < 200; ++i) {
+    probes.push_back(Jitter(rng, faces[rng() % count], 0.03f));
+  }
+  std::vector<GalleryMatch> exact;
+  std::vector<GalleryMatch> approx;
+  size_t hit1 = 0;
+  size_t hit5 = 0;
+  for (auto & probe : probes) {
+    gallery.QueryExact(probe, 5, exact);
+    gallery.Query(probe, 5, approx);
+    hit1 += !approx.empty() && approx[0].index == exact[0].index;
+    for (auto & match : exact) {
+      hit5 += std::any_of(
+        approx.begin(), approx.end(), [&match](const GalleryMatch & m) {
+          return m.index == match.index;
+        });
+    }
+  }
+
+  int calls = static_cast<int>(std::max<size_t>(50, 400000 / count));
+  volatile float sink = 0.f;
+  double exact_us = UsPerCall(
+    calls, [&](int i) {
+      gallery.QueryExact(probes[i % probes.size()], 5, exact);
+      sink = sink + exact[0].score;
+    });
+  double ivf_us = UsPerCall(
+    calls, [&](int i) {
+      gallery.Query(probes[i % probes.size()], 5, approx);
+      sink = sink + approx[0].score;
+    });
+  printf(
+    "%6zu %4zu | exact %9.2f ivf %9.2f speedup %5.2fx | recall@1 %.3f recall@5 %.3f | "
+    "train %8.1f ms\n", count, nlist, exact_us, ivf_us, exact_us / ivf_us,
+    static_cast<double>(hit1) / probes.size(),
+    static_cast<double>(hit5) / (probes.size() * 5), train_ms);
+}
+
+}  // namespace cyberdog_vision
+
+int main(int argc, char ** argv)
+{
+  size_t dim = argc > 1 ? strtoul(argv[1], nullptr, 10) : 512;
+  std::mt19937 rng(37);
+  printf("dim %zu, us per query with k 5\n  size nlist\n", dim);
+  for (size_t count : {128, 256, 512, 1024, 2048, 4096, 8192, 16384}) {
+    cyberdog_vision::Bench(count, dim, rng);
+  }
+  return 0;
+}
@@ -0,0 +1,147 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "cyberdog_vision/face_gallery.hpp"
+#include "cyberdog_vision/reid_gallery.hpp"
+
+// Memory, query latency and score drift of the fp16 and int8 face and reid
+// galleries against the float ones they are quantized from
+namespace cyberdog_vision
+{
+
+static std::vector<float> RandomFeat(std::mt19937 & rng, size_t dim, float sigma)
+{
+  std::normal_distribution<float> dist(0.f, sigma);
+  std::vector<float> feat(dim);
+  for (auto & value : feat) {
+    value = dist(rng);
+  }
+  return feat;
+}
+
+template<typename Func>
+static double UsPerCall(int calls, Func func)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; ++i) {
+    func(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() / calls;
+}
+
+static void Bench(size_t count, size_t dim, std::mt19937 & rng)
+{
+  FaceGallery reference;
+  std::vector<std::vector<float>> probes;
+  for (size_t i = 0; i < count; ++i) {
+    std::vector<float> center = RandomFeat(rng, dim, 1.f);
+    std::vector<std::vector<float>> templates;
+    for (int t = 0; t < 3; ++t) {
+      std::vector<float> noise = RandomFeat(rng, dim, 0.3f);
+      for (size_t d = 0; d < dim; ++d) {
+        noise[d] += center[d];
+      }
+      templates.push_back(noise);
+    }
+    reference.Add("face_" + std::to_string(i), templates, {1.f, 1.f, 1.f}, false);
+    if (probes.size() < 200) {
+      probes.push_back(center);
+    }
+  }
+
+  int calls = static_cast<int>(std::max<size_t>(20, 200000 / count));
+  std::vector<GalleryMatch> matches;
+  volatile float sink = 0.f;
+  for (FeatPrecision precision : {kFeatFp32, kFeatFp16, kFeatInt8}) {
+    FaceGallery gallery(reference);
+    gallery.SetPrecision(precision);
+    QuantReport report;
+    MeasureQuantError(reference, gallery, 256, report);
+    double us = UsPerCall(
+      calls, [&](int i) {
+        gallery.QueryExact(probes[i % probes.size()], 1, matches);
+        sink = sink + matches[0].score;
+      });
+    printf(
+      "%6zu %-4s | %10zu bytes | query %9.2f us | delta mean %.5f max %.5f top1 %.3f\n",
+      count, FeatPrecisionName(precision), gallery.Bytes(), us, report.mean_delta,
+      report.max_delta, report.top1_agree);
+  }
+}
+
+// A full reid gallery of one target, pushes go through the diverse policy
+static void BenchReID(size_t dim, size_t capacity, std::mt19937 & rng)
+{
+  std::vector<std::vector<float>> feats;
+  std::vector<float> center = RandomFeat(rng, dim, 1.f);
+  for (int i = 0; i < 64; ++i) {
+    std::vector<float> feat = RandomFeat(rng, dim, 0.5f);
+    for (size_t d = 0; d < dim; ++d) {
+      feat[d] += center[d];
+    }
+    feats.push_back(feat);
+  }
+  std::unique_ptr<ReIDGalleryBase> reference = MakeReIDGallery(dim, capacity, kGalleryDiverse);
+  for (size_t i = 0; i < capacity; ++i) {
+    reference->Push(feats[i % feats.size()].data(), i);
+  }
+
+  const int calls = 20000;
+  volatile float sink = 0.f;
+  for (FeatPrecision precision : {kFeatFp32, kFeatFp16, kFeatInt8}) {
+    std::unique_ptr<ReIDGalleryBase> gallery = reference->Clone();
+    gallery->SetPrecision(precision);
+    QuantReport report;
+    MeasureQuantError(*reference, *gallery, report);
+    double one2group_ns = UsPerCall(
+      calls, [&](int i) {
+        sink = sink + gallery->One2Group(feats[i % feats.size()].data());
+      }) * 1000.;
+    std::unique_ptr<ReIDGalleryBase> pushed = gallery->Clone();
+    double push_ns = UsPerCall(
+      calls, [&](int i) {pushed->Push(feats[i % feats.size()].data(), i);}) * 1000.;
+    printf(
+      "reid %4zu x %2zu %-4s | %6zu bytes | one2group %6.1f ns push %7.1f ns | "
+      "delta mean %.5f max %.5f top1 %.3f\n", dim, capacity, FeatPrecisionName(precision),
+      gallery->Bytes(), one2group_ns, push_ns, report.mean_delta, report.max_delta,
+      report.top1_agree);
+  }
+}
+
+}  // namespace cyberdog_vision
+
+int main(int argc, char ** argv)
+{
+  size_t dim = argc > 1 ? strtoul(argv[1], nullptr, 10) : 512;
+  std::mt19937 rng(37);
+  printf("dim %zu, exact top 1 query\n", dim);
+  for (size_t count : {100, 1000, 10000}) {
+    cyberdog_vision::Bench(count, dim, rng);
+  }
+  for (size_t reid_dim : {128, 256, 512}) {
+    cyberdog_vision::BenchReID(reid_dim, 15, rng);
+  }
+  return 0;
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <memory>
+
+#include "cyberdog_vision/reid_gallery.hpp"
+#include "cyberdog_vision/assignment.hpp"
+
+// Microbenchmark of the reid gallery kernels and the assignment solver,
+// reported in nanoseconds per call
+namespace cyberdog_vision
+{
+
+static std::vector<float> RandomFeats(std::mt19937 & rng, size_t count)
+{
+  std::normal_distribution<float> dist(0.f, 1.f);
+  std::vector<float> feats(count);
+  for (auto & value : feats) {
+    value = dist(rng);
+  }
+  return feats;
+}
+
+template<typename Func>
+static double NsPerCall(int calls, Func func)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; ++i) {
+    func(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / calls;
+}
+
+// The flat gallery replaced by the ring, every push shifts all rows
+static void FlatPush(std::vector<float> & flat, const float * feat, size_t dim, size_t capacity)
+{
+  if (flat.size() >= dim * capacity) {
+    flat.erase(flat.begin(), flat.begin() + dim);
+  }
+  flat.insert(flat.end(), feat, feat + dim);
+}
+
+static void BenchGallery(size_t dim, size_t capacity, std::mt19937 & rng)
+{
+  const int calls = 20000;
+  std::vector<float> feats = RandomFeats(rng, dim * 64);
+  volatile float sink = 0.f;
+
+  std::unique_ptr<ReIDGalleryBase> fixed = MakeReIDGallery(dim, capacity);
+  std::unique_ptr<ReIDGalleryBase> runtime(new ReIDGallery<0>(capacity, kGalleryFifo, dim));
+  std::unique_ptr<ReIDGalleryBase> diverse = MakeReIDGallery(dim, capacity, kGalleryDiverse);
+  for (size_t i = 0; i < capacity; ++i) {
+    fixed->Push(&feats[(i % 64) * dim], i);
+    runtime->Push(&feats[(i % 64) * dim], i);
+    diverse->Push(&feats[(i % 64) * dim], i);
+  }
+
+  double one2group_fixed = NsPerCall(
+    calls, [&](int i) {sink = sink + fixed->One2Group(&feats[(i % 64) * dim]);});
+  double one2group_runtime = NsPerCall(
+    calls, [&](int i) {sink = sink + runtime->One2Group(&feats[(i % 64) * dim]);});
+  std::vector<float> rows;
+  fixed->CopyTo(rows);
+  double one2group_pairwise = NsPerCall(
+    calls, [&](int i) {
+      float sum = 0.f;
+      for (size_t r = 0; r < fixed->Size(); ++r) {
+        sum += Cosine(&feats[(i % 64) * dim], &rows[r * dim], dim);
+      }
+      sink = sink + sum / fixed->Size();
+    });
+  double group2group = NsPerCall(
+    calls, [&](int i) {sink = sink + fixed->Group2Group(&feats[(i % 60) * dim], 4);});
+
+  double push_fifo = NsPerCall(
+    calls, [&](int i) {fixed->Push(&feats[(i % 64) * dim], i);});
+  double push_diverse = NsPerCall(
+    calls, [&](int i) {diverse->Push(&feats[(i % 64) * dim], i);});
+  std::vector<float> flat;
+  double push_flat = NsPerCall(
+    calls, [&](int i) {FlatPush(flat, &feats[(i % 64) * dim], dim, capacity);});
+
+  printf(
+    "%4zu %4zu | one2group fixed %8.1f runtime %8.1f pairwise %8.1f | group2group(4) %8.1f | "
+    "push fifo %8.1f diverse %8.1f flat %8.1f\n", dim, capacity, one2group_fixed,
+    one2group_runtime, one2group_pairwise, group2group, push_fifo, push_diverse, push_flat);
+}
+
+static void BenchAssignment(size_t rows, size_t cols, std::mt19937 & rng)
+{
+  const int calls = 2000;
+  std::uniform_real_distribution<float> dist(0.f, 1.f);
+  std::vector<std::vector<float>> cost(rows, std::vector<float>(cols));
+  for (auto & row : cost) {
+    for (auto & value : row) {
+      value = dist(rng);
+    }
+  }
+  std::vector<int> assign;
+  volatile float sink = 0.f;
+  double ns = NsPerCall(calls, [&](int) {sink = sink + SolveAssignment(cost, assign);});
+  printf("assignment %2zu x %2zu %10.1f\n", rows, cols, ns);
+}
+
+}  // namespace cyberdog_vision
+
+int main()
+{
+  using cyberdog_vision::BenchGallery;
+  using cyberdog_vision::BenchAssignment;
+  std::mt19937 rng(29);
+  printf(" dim  cap | ns per call\n");
+  for (size_t dim : {128, 256, 512, 200}) {
+    for (size_t capacity : {5, 15, 30}) {
+      BenchGallery(dim, capacity, rng);
+    }
+  }
+  for (size_t targets : {1, 2, 4, 8}) {
+    for (size_t dets : {4, 8, 16}) {
+      BenchAssignment(targets, dets, rng);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,161 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "cyberdog_vision/assignment.hpp"
+
+namespace cyberdog_vision
+{
+
+// Best total over every injective map of the shorter side into the longer
+static float BruteForce(const std::vector<std::vector<float>> & cost)
+{
+  size_t rows = cost.size();
+  size_t cols = cost[0].size();
+  size_t n = std::min(rows, cols);
+  size_t m = std::max(rows, cols);
+  std::vector<size_t> perm(m);
+  for (size_t i = 0; i < m; ++i) {
+    perm[i] = i;
+  }
+  float best = std::numeric_limits<float>::max();
+  do {
+    float total = 0.f;
+    for (size_t i = 0; i < n; ++i) {
+      total += rows <= cols ? cost[i][perm[i]] : cost[perm[i]][i];
+    }
+    best = std::min(best, total);
+  } while (std::next_permutation(perm.begin(), perm.end()));
+  return best;
+}
+
+// Assignment is one to one and its cost is the returned total
+static void ExpectValid(
+  const std::vector<std::vector<float>> & cost, const std::vector<int> & assign,
+  float total)
+{
+  ASSERT_EQ(assign.size(), cost.size());
+  size_t cols = cost[0].size();
+  std::vector<bool> used(cols, false);
+  size_t matched = 0;
+  float sum = 0.f;
+  for (size_t i = 0; i < assign.size(); ++i) {
+    if (assign[i] < 0) {
+      continue;
+    }
+    ASSERT_LT(static_cast<size_t>(assign[i]), cols);
+    EXPECT_FALSE(used[assign[i]]);
+    used[assign[i]] = true;
+    sum += cost[i][assign[i]];
+    matched++;
+  }
+  EXPECT_EQ(matched, std::min(cost.size(), cols));
+  EXPECT_NEAR(sum, total, 1e-4);
+}
+
+static std::vector<std::vector<float>> RandomCost(std::mt19937 & rng, size_t rows, size_t cols)
+{
+  std::uniform_real_distribution<float> dist(0.f, 1.f);
+  std::vector<std::vector<float>> cost(rows, std::vector<float>(cols));
+  for (auto & row : cost) {
+    for (auto & value : row) {
+      value = dist(rng);
+    }
+  }
+  return cost;
+}
+
+TEST(AssignmentTest, SquareKnownOptimum)
+{
+  std::vector<std::vector<float>> cost = {{4, 1, 3}, {2, 0, 5}, {3, 2, 2}};
+  std::vector<int> assign;
+  float total = SolveAssignment(cost, assign);
+  EXPECT_FLOAT_EQ(total, 5.f);
+  EXPECT_EQ(assign, std::vector<int>({1, 0, 2}));
+}
+
+TEST(AssignmentTest, EmptyInput)
+{
+  std::vector<std::vector<float>> cost;
+  std::vector<int> assign(3, 7);
+  EXPECT_EQ(SolveAssignment(cost, assign), 0.f);
+  EXPECT_TRUE(assign.empty());
+
+  cost.assign(2, std::vector<float>());
+  EXPECT_EQ(SolveAssignment(cost, assign), 0.f);
+  EXPECT_EQ(assign, std::vector<int>({-1, -1}));
+}
+
+TEST(AssignmentTest, RectangularMoreColumns)
+{
+  std::vector<std::vector<float>> cost = {{9, 1, 9, 9}, {9, 2, 9, 0.5}};
+  std::vector<int> assign;
+  float total = SolveAssignment(cost, assign);
+  EXPECT_FLOAT_EQ(total, 1.5f);
+  EXPECT_EQ(assign, std::vector<int>({1, 3}));
+}
+
+TEST(AssignmentTest, TransposedMoreRows)
+{
+  // Rows left over get -1
+  std::vector<std::vector<float>> cost = {{9, 9}, {1, 9}, {9, 9}, {2, 0.5}};
+  std::vector<int> assign;
+  float total = SolveAssignment(cost, assign);
+  EXPECT_FLOAT_EQ(total, 1.5f);
+  EXPECT_EQ(assign, std::vector<int>({-1, 0, -1, 1}));
+}
+
+TEST(AssignmentTest, MatchesBruteForce)
+{
+  std::mt19937 rng(17);
+  for (size_t rows = 1; rows <= 6; ++rows) {
+    for (size_t cols = 1; cols <= 6; ++cols) {
+      for (int round = 0; round < 5; ++round) {
+        std::vector<std::vector<float>> cost = RandomCost(rng, rows, cols);
+        std::vector<int> assign;
+        float total = SolveAssignment(cost, assign);
+        ExpectValid(cost, assign, total);
+        EXPECT_NEAR(total, BruteForce(cost), 1e-4) << rows << "x" << cols;
+      }
+    }
+  }
+}
+
+TEST(AssignmentTest, TransposeGivesSameTotal)
+{
+  std::mt19937 rng(19);
+  std::vector<std::vector<float>> cost = RandomCost(rng, 3, 7);
+  std::vector<std::vector<float>> transposed(7, std::vector<float>(3));
+  for (size_t i = 0; i < 3; ++i) {
+    for (size_t j = 0; j < 7; ++j) {
+      transposed[j][i] = cost[i][j];
+    }
+  }
+  std::vector<int> assign;
+  std::vector<int> assign_t;
+  float total = SolveAssignment(cost, assign);
+  float total_t = SolveAssignment(transposed, assign_t);
+  EXPECT_NEAR(total, total_t, 1e-5);
+  for (size_t i = 0; i < assign.size(); ++i) {
+    EXPECT_EQ(assign_t[assign[i]], static_cast<int>(i));
+  }
+}
+
+}  // namespace cyberdog_vision
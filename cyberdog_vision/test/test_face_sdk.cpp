@@ -0,0 +1,98 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "cyberdog_vision/face_recognition.hpp"
+#include "cyberdog_vision/face_gallery.hpp"
+
+namespace cyberdog_vision
+{
+
+// Models and a frame holding a face installed on the robot, the comparison
+// is skipped without them
+const char kFaceModel[] = "/SDCARD/vision/face_recognition";
+const char kFaceImage[] = "/SDCARD/vision/face_recognition/test_face.jpg";
+const float kSdkTol = 1e-3;
+
+class FaceSdkTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    if (0 != access(kFaceImage, R_OK)) {
+      GTEST_SKIP() << "No face image at " << kFaceImage;
+    }
+    img_ = cv::imread(kFaceImage);
+    ASSERT_FALSE(img_.empty());
+    face_ = std::make_shared<FaceRecognition>(kFaceModel, false, false);
+    ASSERT_EQ(face_->GetFaceInfo(img_, entries_), 0);
+    ASSERT_FALSE(entries_.empty());
+  }
+
+  // Enrolled feature drifting further from the probe as noise grows
+  std::vector<float> Enrolled(const std::vector<float> & feat, float noise)
+  {
+    std::normal_distribution<float> dist(0.f, 1.f);
+    float norm = 0.f;
+    for (auto value : feat) {
+      norm += value * value;
+    }
+    float sigma = noise * sqrtf(norm / feat.size());
+    std::vector<float> enrolled(feat);
+    for (auto & value : enrolled) {
+      value += sigma * dist(rng_);
+    }
+    return enrolled;
+  }
+
+  cv::Mat img_;
+  std::shared_ptr<FaceRecognition> face_;
+  std::vector<EntryFaceInfo> entries_;
+  std::mt19937 rng_{31};
+};
+
+TEST_F(FaceSdkTest, MatchFaceMatchesSdk)
+{
+  const EntryFaceInfo & entry = entries_[0];
+  face_->SetMatchThres(kFaceMatchThres);
+  for (float noise : {0.f, 0.3f, 0.6f, 0.9f, 1.2f, 2.f}) {
+    std::vector<float> enrolled = Enrolled(entry.feats, noise);
+    std::map<std::string, std::vector<float>> library;
+    library["probe"] = enrolled;
+    std::vector<MatchFaceInfo> sdk_infos;
+    ASSERT_EQ(face_->GetSdkMatchResult(img_, library, sdk_infos), 0);
+    ASSERT_FALSE(sdk_infos.empty());
+
+    FaceGallery gallery;
+    ASSERT_EQ(gallery.Add("probe", enrolled, false), 0);
+    MatchFaceInfo info;
+    face_->MatchFace(entry, gallery, info);
+    // Same detector on the same frame, the first face is the same one
+    EXPECT_EQ(info.face_id, sdk_infos[0].face_id) << "noise " << noise;
+    if (!sdk_infos[0].face_id.empty()) {
+      EXPECT_NEAR(info.match_score, sdk_infos[0].match_score, kSdkTol) << "noise " << noise;
+    }
+  }
+}
+
+}  // namespace cyberdog_vision
@@ -0,0 +1,300 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <random>
+#include <vector>
+#include <memory>
+
+#include "cyberdog_vision/reid_gallery.hpp"
+
+namespace cyberdog_vision
+{
+
+static std::vector<float> RandomFeat(std::mt19937 & rng, size_t dim)
+{
+  std::normal_distribution<float> dist(0.f, 1.f);
+  std::vector<float> feat(dim);
+  for (auto & value : feat) {
+    value = dist(rng);
+  }
+  return feat;
+}
+
+static double RefCosine(const float * a, const float * b, size_t len)
+{
+  double ab = 0., aa = 0., bb = 0.;
+  for (size_t i = 0; i < len; ++i) {
+    ab += static_cast<double>(a[i]) * b[i];
+    aa += static_cast<double>(a[i]) * a[i];
+    bb += static_cast<double>(b[i]) * b[i];
+  }
+  return ab / sqrt(aa * bb);
+}
+
+static double RefOne2Group(
+  const std::vector<float> & feat, const std::vector<std::vector<float>> & group)
+{
+  double sum = 0.;
+  for (auto & row : group) {
+    sum += RefCosine(feat.data(), row.data(), feat.size());
+  }
+  return sum / group.size();
+}
+
+// Rows kept by the gallery, matched back to the pushed features by cosine
+static bool Holds(const ReIDGalleryBase & gallery, const std::vector<float> & feat)
+{
+  std::vector<float> row(gallery.Dim());
+  for (size_t i = 0; i < gallery.Size(); ++i) {
+    gallery.Get(i, row.data());
+    if (RefCosine(row.data(), feat.data(), feat.size()) > 1. - 1e-5) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void ExpectOne2Group(ReIDGalleryBase & gallery, size_t dim)
+{
+  std::mt19937 rng(7);
+  std::vector<std::vector<float>> group;
+  for (size_t i = 0; i < gallery.Capacity(); ++i) {
+    group.push_back(RandomFeat(rng, dim));
+    gallery.Push(group.back().data(), i);
+  }
+  for (int probe = 0; probe < 16; ++probe) {
+    std::vector<float> feat = RandomFeat(rng, dim);
+    EXPECT_NEAR(gallery.One2Group(feat.data()), RefOne2Group(feat, group), 1e-5);
+  }
+}
+
+TEST(ReIDGalleryTest, CosineMatchesReference)
+{
+  std::mt19937 rng(1);
+  for (size_t dim : {1, 7, 8, 15, 16, 100, 128, 513}) {
+    std::vector<float> a = RandomFeat(rng, dim);
+    std::vector<float> b = RandomFeat(rng, dim);
+    EXPECT_NEAR(Cosine(a.data(), b.data(), dim), RefCosine(a.data(), b.data(), dim), 1e-5);
+    EXPECT_NEAR(Cosine(a.data(), a.data(), dim), 1.f, 1e-5);
+  }
+  std::vector<float> zero(16, 0.f);
+  std::vector<float> one(16, 1.f);
+  EXPECT_EQ(Cosine(zero.data(), one.data(), 16), 0.f);
+}
+
+TEST(ReIDGalleryTest, One2GroupFixedDim)
+{
+  ReIDGallery<128> gallery(15);
+  ExpectOne2Group(gallery, 128);
+  ReIDGallery<512> large(4);
+  ExpectOne2Group(large, 512);
+}
+
+TEST(ReIDGalleryTest, One2GroupRuntimeDim)
+{
+  ReIDGallery<0> gallery(15, kGalleryFifo, 100);
+  EXPECT_EQ(gallery.Dim(), 100u);
+  ExpectOne2Group(gallery, 100);
+}
+
+TEST(ReIDGalleryTest, FactoryPicksSameResult)
+{
+  std::unique_ptr<ReIDGalleryBase> fixed = MakeReIDGallery(128, 6);
+  ReIDGallery<0> runtime(6, kGalleryFifo, 128);
+  std::mt19937 rng(3);
+  for (int i = 0; i < 6; ++i) {
+    std::vector<float> feat = RandomFeat(rng, 128);
+    fixed->Push(feat.data(), i);
+    runtime.Push(feat.data(), i);
+  }
+  std::vector<float> probe = RandomFeat(rng, 128);
+  EXPECT_NEAR(fixed->One2Group(probe.data()), runtime.One2Group(probe.data()), 1e-6);
+  EXPECT_EQ(MakeReIDGallery(96, 2)->Dim(), 96u);
+}
+
+TEST(ReIDGalleryTest, Group2GroupMatchesReference)
+{
+  const size_t dim = 128;
+  std::mt19937 rng(5);
+  ReIDGallery<dim> gallery(5);
+  std::vector<std::vector<float>> group;
+  for (int i = 0; i < 5; ++i) {
+    group.push_back(RandomFeat(rng, dim));
+    gallery.Push(group.back().data(), i);
+  }
+  std::vector<float> feats;
+  double sum = 0.;
+  for (int i = 0; i < 3; ++i) {
+    std::vector<float> feat = RandomFeat(rng, dim);
+    feats.insert(feats.end(), feat.begin(), feat.end());
+    sum += RefOne2Group(feat, group);
+  }
+  EXPECT_NEAR(gallery.Group2Group(feats.data(), 3), sum / 3, 1e-5);
+  EXPECT_EQ(gallery.Group2Group(feats.data(), 0), 0.f);
+}
+
+TEST(ReIDGalleryTest, FifoReplacesOldest)
+{
+  const size_t dim = 16;
+  std::mt19937 rng(11);
+  ReIDGallery<dim> gallery(3, kGalleryFifo);
+  std::vector<std::vector<float>> pushed;
+  for (int i = 0; i < 5; ++i) {
+    pushed.push_back(RandomFeat(rng, dim));
+    gallery.Push(pushed.back().data(), 100 + i);
+  }
+  EXPECT_EQ(gallery.Size(), 3u);
+  EXPECT_FALSE(Holds(gallery, pushed[0]));
+  EXPECT_FALSE(Holds(gallery, pushed[1]));
+  for (int i = 2; i < 5; ++i) {
+    EXPECT_TRUE(Holds(gallery, pushed[i]));
+  }
+  EXPECT_NEAR(RefCosine(gallery.Newest(), pushed[4].data(), dim), 1., 1e-5);
+
+  int64_t stamps = 0;
+  for (size_t i = 0; i < gallery.Size(); ++i) {
+    stamps += gallery.Stamp(i);
+  }
+  EXPECT_EQ(stamps, 102 + 103 + 104);
+}
+
+TEST(ReIDGalleryTest, DiverseDropsNearDuplicate)
+{
+  const size_t dim = 8;
+  std::vector<float> a(dim, 0.f), near(dim, 0.f), b(dim, 0.f), c(dim, 0.f), d(dim, 0.f);
+  a[0] = 1.f;
+  near[0] = 1.f;
+  near[1] = 0.01f;
+  b[2] = 1.f;
+  c[3] = 1.f;
+  d[4] = 1.f;
+
+  ReIDGallery<dim> gallery(3, kGalleryDiverse);
+  gallery.Push(a.data(), 0);
+  gallery.Push(near.data(), 1);
+  gallery.Push(b.data(), 2);
+  // The closest pair is a and near, the older one makes room
+  gallery.Push(c.data(), 3);
+  EXPECT_EQ(gallery.Size(), 3u);
+  EXPECT_FALSE(Holds(gallery, a));
+  EXPECT_TRUE(Holds(gallery, near));
+  EXPECT_TRUE(Holds(gallery, b));
+  EXPECT_TRUE(Holds(gallery, c));
+
+  // A new row closer to a kept one than any pair only refreshes that row
+  std::vector<float> b2(b);
+  b2[5] = 0.001f;
+  gallery.Push(b2.data(), 4);
+  EXPECT_TRUE(Holds(gallery, near));
+  EXPECT_TRUE(Holds(gallery, c));
+  EXPECT_TRUE(Holds(gallery, b2));
+  EXPECT_FALSE(Holds(gallery, d));
+
+  // The sum follows the replacements
+  std::vector<std::vector<float>> kept = {near, b2, c};
+  EXPECT_NEAR(gallery.One2Group(d.data()), RefOne2Group(d, kept), 1e-6);
+  EXPECT_NEAR(gallery.One2Group(near.data()), RefOne2Group(near, kept), 1e-6);
+}
+
+TEST(ReIDGalleryTest, SumStaysExactOverManyPushes)
+{
+  const size_t dim = 128;
+  std::mt19937 rng(13);
+  for (GalleryPolicy policy : {kGalleryFifo, kGalleryDiverse}) {
+    ReIDGallery<dim> gallery(4, policy);
+    for (int i = 0; i < 1000; ++i) {
+      std::vector<float> feat = RandomFeat(rng, dim);
+      gallery.Push(feat.data(), i);
+    }
+    std::vector<std::vector<float>> kept;
+    for (size_t i = 0; i < gallery.Size(); ++i) {
+      kept.emplace_back(dim);
+      gallery.Get(i, kept.back().data());
+    }
+    std::vector<float> probe = RandomFeat(rng, dim);
+    EXPECT_NEAR(gallery.One2Group(probe.data()), RefOne2Group(probe, kept), 1e-5);
+  }
+}
+
+TEST(ReIDGalleryTest, ClearEmptiesGallery)
+{
+  ReIDGallery<16> gallery(3);
+  std::vector<float> feat(16, 1.f);
+  gallery.Push(feat.data(), 0);
+  gallery.Clear();
+  EXPECT_EQ(gallery.Size(), 0u);
+  EXPECT_EQ(gallery.One2Group(feat.data()), 0.f);
+  GalleryPolicy policy;
+  EXPECT_TRUE(ParseGalleryPolicy("diverse", policy));
+  EXPECT_EQ(policy, kGalleryDiverse);
+  EXPECT_FALSE(ParseGalleryPolicy("lru", policy));
+}
+
+TEST(ReIDGalleryTest, QuantizedRowsKeepScores)
+{
+  const size_t dim = 128;
+  std::mt19937 rng(17);
+  for (FeatPrecision precision : {kFeatFp16, kFeatInt8}) {
+    for (GalleryPolicy policy : {kGalleryFifo, kGalleryDiverse}) {
+      std::unique_ptr<ReIDGalleryBase> reference = MakeReIDGallery(dim, 15, policy);
+      std::unique_ptr<ReIDGalleryBase> quantized = MakeReIDGallery(dim, 15, policy, precision);
+      for (int i = 0; i < 40; ++i) {
+        std::vector<float> feat = RandomFeat(rng, dim);
+        reference->Push(feat.data(), i);
+        quantized->Push(feat.data(), i);
+      }
+      EXPECT_EQ(quantized->Precision(), precision);
+      EXPECT_LT(quantized->Bytes() * 2, reference->Bytes() + 1);
+
+      // The sum follows the stored rows, not the pushed ones
+      std::vector<std::vector<float>> kept;
+      for (size_t i = 0; i < quantized->Size(); ++i) {
+        kept.emplace_back(dim);
+        quantized->Get(i, kept.back().data());
+      }
+      std::vector<float> probe = RandomFeat(rng, dim);
+      EXPECT_NEAR(quantized->One2Group(probe.data()), RefOne2Group(probe, kept), 1e-5);
+      EXPECT_NEAR(quantized->One2Group(probe.data()), reference->One2Group(probe.data()), 5e-3);
+    }
+  }
+}
+
+TEST(ReIDGalleryTest, SetPrecisionReportsDrift)
+{
+  const size_t dim = 256;
+  std::mt19937 rng(19);
+  std::unique_ptr<ReIDGalleryBase> reference = MakeReIDGallery(dim, 15, kGalleryDiverse);
+  for (int i = 0; i < 15; ++i) {
+    std::vector<float> feat = RandomFeat(rng, dim);
+    reference->Push(feat.data(), i);
+  }
+  for (FeatPrecision precision : {kFeatFp32, kFeatFp16, kFeatInt8}) {
+    std::unique_ptr<ReIDGalleryBase> quantized = reference->Clone();
+    quantized->SetPrecision(precision);
+    QuantReport report;
+    MeasureQuantError(*reference, *quantized, report);
+    EXPECT_EQ(report.probes, 15u);
+    EXPECT_LT(report.max_delta, precision == kFeatInt8 ? 5e-3f : 1e-3f);
+    EXPECT_FLOAT_EQ(report.top1_agree, 1.f);
+    if (precision == kFeatFp32) {
+      EXPECT_EQ(report.max_delta, 0.f);
+    }
+    EXPECT_NEAR(RefCosine(quantized->Newest(), reference->Newest(), dim), 1., 1e-3);
+  }
+}
+
+}  // namespace cyberdog_vision
@@ -0,0 +1,116 @@
+// Copyright (c) 2023 Beijing Xiaomi Mobile Software Co., Ltd. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+#include <memory>
+
+#include "ReIDToolAPI.h"
+#include "cyberdog_vision/reid_gallery.hpp"
+
+namespace cyberdog_vision
+{
+
+// Model installed on the robot, the comparison is skipped without it
+const char kReIDModel[] = "/SDCARD/vision/person_reid/reid_v4_mid.engine";
+const float kSdkTol = 1e-3;
+
+class ReIDSdkTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    if (0 != access(kReIDModel, R_OK)) {
+      GTEST_SKIP() << "No reid model at " << kReIDModel;
+    }
+    ASSERT_EQ(REID_Init(handle_, kReIDModel, 0), 0);
+    dim_ = REID_GetFeatLen();
+    ASSERT_GT(dim_, 0);
+  }
+
+  void TearDown() override
+  {
+    if (handle_ != nullptr) {
+      REID_Release(handle_);
+    }
+  }
+
+  std::vector<float> RandomFeat()
+  {
+    std::normal_distribution<float> dist(0.f, 1.f);
+    std::vector<float> feat(dim_);
+    for (auto & value : feat) {
+      value = dist(rng_);
+    }
+    return feat;
+  }
+
+  void * handle_ = nullptr;
+  int dim_ = 0;
+  std::mt19937 rng_{23};
+};
+
+TEST_F(ReIDSdkTest, CosineMatchesOne2One)
+{
+  for (int i = 0; i < 32; ++i) {
+    std::vector<float> a = RandomFeat();
+    std::vector<float> b = RandomFeat();
+    EXPECT_NEAR(
+      Cosine(a.data(), b.data(), dim_),
+      REID_GetSimOfOne2One(handle_, a.data(), b.data()), kSdkTol);
+  }
+}
+
+TEST_F(ReIDSdkTest, One2GroupMatchesSdk)
+{
+  for (GalleryPolicy policy : {kGalleryFifo, kGalleryDiverse}) {
+    std::unique_ptr<ReIDGalleryBase> gallery = MakeReIDGallery(dim_, 15, policy);
+    for (int i = 0; i < 40; ++i) {
+      std::vector<float> feat = RandomFeat();
+      gallery->Push(feat.data(), i);
+      std::vector<float> library;
+      gallery->CopyTo(library);
+      std::vector<float> probe = RandomFeat();
+      EXPECT_NEAR(
+        gallery->One2Group(probe.data()),
+        REID_GetSimOfOne2Group(handle_, probe.data(), library.data(), gallery->Size()),
+        kSdkTol);
+    }
+  }
+}
+
+TEST_F(ReIDSdkTest, Group2GroupMatchesSdk)
+{
+  std::unique_ptr<ReIDGalleryBase> gallery = MakeReIDGallery(dim_, 15);
+  for (int i = 0; i < 15; ++i) {
+    std::vector<float> feat = RandomFeat();
+    gallery->Push(feat.data(), i);
+  }
+  std::vector<float> library;
+  gallery->CopyTo(library);
+  std::vector<float> feats;
+  for (int i = 0; i < 4; ++i) {
+    std::vector<float> feat = RandomFeat();
+    feats.insert(feats.end(), feat.begin(), feat.end());
+  }
+  EXPECT_NEAR(
+    gallery->Group2Group(feats.data(), 4),
+    REID_GetSimOfGroup2Group(handle_, feats.data(), 4, library.data(), gallery->Size()),
+    kSdkTol);
+}
+
+}  // namespace cyberdog_vision